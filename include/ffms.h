@@ -22,7 +22,7 @@
 #define FFMS_H
 
 // Version format: major - minor - micro - bump
-#define FFMS_VERSION ((2 << 24) | (17 << 16) | (1 << 8) | 1)
+#define FFMS_VERSION ((2 << 24) | (17 << 16) | (1 << 8) | 3)
 
 #include <stdint.h>
 
@@ -154,6 +154,13 @@ enum FFMS_SeekMode {
 	FFMS_SEEK_AGGRESSIVE	= 3
 };
 
+enum FFMS_VideoSourceFlags {
+	/* Introduced in FFMS_VERSION ((2 << 24) | (17 << 16) | (1 << 8) | 3) */
+	FFMS_VSF_PREVIEW		= 0x01,
+	/* Introduced in FFMS_VERSION ((2 << 24) | (17 << 16) | (1 << 8) | 3) */
+	FFMS_VSF_LAZY			= 0x02
+};
+
 enum FFMS_IndexErrorHandling {
 	FFMS_IEH_ABORT = 0,
 	FFMS_IEH_CLEAR_TRACK = 1,
@@ -237,6 +244,17 @@ enum FFMS_ColorRanges {
 	FFMS_CR_JPEG		= 2, // 2^n-1, or "fullrange"
 };
 
+enum FFMS_TensorTypes {
+	FFMS_TENSOR_FLOAT32	= 0,
+	FFMS_TENSOR_FLOAT16	= 1
+};
+
+enum FFMS_Fields {
+	FFMS_FIELD_NONE		= -1,
+	FFMS_FIELD_TOP		= 0,
+	FFMS_FIELD_BOTTOM	= 1
+};
+
 typedef struct FFMS_Frame {
 	uint8_t *Data[4];
 	int Linesize[4];
@@ -253,6 +271,10 @@ typedef struct FFMS_Frame {
 	char PictType;
 	int ColorSpace;
 	int ColorRange;
+	/* Introduced in FFMS_VERSION ((2 << 24) | (17 << 16) | (1 << 8) | 3) */
+	int Preview;
+	/* Introduced in FFMS_VERSION ((2 << 24) | (17 << 16) | (1 << 8) | 3) */
+	int Field;
 } FFMS_Frame;
 
 typedef struct FFMS_TrackTimeBase {
@@ -283,8 +305,19 @@ typedef struct FFMS_VideoProperties {
 	FFMS_DEPRECATED int ColorRange;
 	double FirstTime;
 	double LastTime;
+	/* Introduced in FFMS_VERSION ((2 << 24) | (17 << 16) | (1 << 8) | 3) */
+	int EncodedWidth;
+	int EncodedHeight;
+	int EncodedPixelFormat;
 } FFMS_VideoProperties;
 
+typedef struct FFMS_BufferPoolStats {
+	int64_t Hits;
+	int64_t Misses;
+	int64_t BytesInUse;
+	int64_t BytesCached;
+} FFMS_BufferPoolStats;
+
 typedef struct FFMS_AudioProperties {
 	int SampleFormat;
 	int SampleRate;
@@ -297,6 +330,8 @@ typedef struct FFMS_AudioProperties {
 } FFMS_AudioProperties;
 
 typedef int (FFMS_CC *TIndexCallback)(int64_t Current, int64_t Total, void *ICPrivate);
+typedef int (FFMS_CC *TFrameCallback)(int n, int Position, const FFMS_Frame *Frame, void *Private);
+typedef void (FFMS_CC *TExactFrameCallback)(int n, const FFMS_Frame *Frame, void *Private);
 typedef int (FFMS_CC *TAudioNameCallback)(const char *SourceFile, int Track, const FFMS_AudioProperties *AP, char *FileName, int FNSize, void *Private);
 
 // Most functions return 0 on success
@@ -306,19 +341,41 @@ FFMS_API(int) FFMS_GetVersion();
 FFMS_API(int) FFMS_GetLogLevel();
 FFMS_API(void) FFMS_SetLogLevel(int Level);
 FFMS_API(FFMS_VideoSource *) FFMS_CreateVideoSource(const char *SourceFile, int Track, FFMS_Index *Index, int Threads, int SeekMode, FFMS_ErrorInfo *ErrorInfo);
+FFMS_API(FFMS_VideoSource *) FFMS_CreateVideoSource2(const char *SourceFile, int Track, FFMS_Index *Index, int Threads, int SeekMode, int Flags, FFMS_ErrorInfo *ErrorInfo); /* Introduced in FFMS_VERSION ((2 << 24) | (17 << 16) | (1 << 8) | 3) */
 FFMS_API(FFMS_AudioSource *) FFMS_CreateAudioSource(const char *SourceFile, int Track, FFMS_Index *Index, int DelayMode, FFMS_ErrorInfo *ErrorInfo);
 FFMS_API(void) FFMS_DestroyVideoSource(FFMS_VideoSource *V);
 FFMS_API(void) FFMS_DestroyAudioSource(FFMS_AudioSource *A);
 FFMS_API(const FFMS_VideoProperties *) FFMS_GetVideoProperties(FFMS_VideoSource *V);
 FFMS_API(const FFMS_AudioProperties *) FFMS_GetAudioProperties(FFMS_AudioSource *A);
 FFMS_API(const FFMS_Frame *) FFMS_GetFrame(FFMS_VideoSource *V, int n, FFMS_ErrorInfo *ErrorInfo);
+FFMS_API(const FFMS_Frame *) FFMS_GetFrameInto(FFMS_VideoSource *V, int n, uint8_t *const *Data, const int *Linesize, int Format, int Width, int Height, FFMS_ErrorInfo *ErrorInfo); /* Introduced in FFMS_VERSION ((2 << 24) | (17 << 16) | (1 << 8) | 3) */
+FFMS_API(const FFMS_Frame *) FFMS_GetFrameRef(FFMS_VideoSource *V, int n, FFMS_ErrorInfo *ErrorInfo); /* Introduced in FFMS_VERSION ((2 << 24) | (17 << 16) | (1 << 8) | 3) */
+FFMS_API(int) FFMS_AddFrameRef(const FFMS_Frame *Frame, FFMS_ErrorInfo *ErrorInfo); /* Introduced in FFMS_VERSION ((2 << 24) | (17 << 16) | (1 << 8) | 3) */
+FFMS_API(int) FFMS_ReleaseFrame(const FFMS_Frame *Frame, FFMS_ErrorInfo *ErrorInfo); /* Introduced in FFMS_VERSION ((2 << 24) | (17 << 16) | (1 << 8) | 3) */
+FFMS_API(void) FFMS_SetFrameRefLimitV(FFMS_VideoSource *V, int MaxFrames); /* Introduced in FFMS_VERSION ((2 << 24) | (17 << 16) | (1 << 8) | 3) */
+FFMS_API(const FFMS_Frame *) FFMS_GetFrameField(FFMS_VideoSource *V, int n, int Field, FFMS_ErrorInfo *ErrorInfo); /* Introduced in FFMS_VERSION ((2 << 24) | (17 << 16) | (1 << 8) | 3) */
 FFMS_API(const FFMS_Frame *) FFMS_GetFrameByTime(FFMS_VideoSource *V, double Time, FFMS_ErrorInfo *ErrorInfo);
+FFMS_API(const FFMS_Frame *) FFMS_GetNearestKeyFrame(FFMS_VideoSource *V, int n, int *KeyFrame, FFMS_ErrorInfo *ErrorInfo); /* Introduced in FFMS_VERSION ((2 << 24) | (17 << 16) | (1 << 8) | 3) */
+FFMS_API(const FFMS_Frame *) FFMS_GetNearestKeyFrameByTime(FFMS_VideoSource *V, double Time, int *KeyFrame, FFMS_ErrorInfo *ErrorInfo); /* Introduced in FFMS_VERSION ((2 << 24) | (17 << 16) | (1 << 8) | 3) */
+FFMS_API(int) FFMS_GetFrames(FFMS_VideoSource *V, const int *Frames, int NumFrames, TFrameCallback FC, void *Private, FFMS_ErrorInfo *ErrorInfo); /* Introduced in FFMS_VERSION ((2 << 24) | (17 << 16) | (1 << 8) | 3) */
+FFMS_API(int) FFMS_GetFramesTensor(FFMS_VideoSource *V, const int *Frames, int NumFrames, void *Tensor, int Width, int Height, int Type, const float *Mean, const float *Std, FFMS_ErrorInfo *ErrorInfo); /* Introduced in FFMS_VERSION ((2 << 24) | (17 << 16) | (1 << 8) | 3) */
+FFMS_API(const FFMS_Frame *) FFMS_GetFrameProgressive(FFMS_VideoSource *V, int n, int MaxDecode, int *FrameNum, TExactFrameCallback EFC, void *Private, FFMS_ErrorInfo *ErrorInfo); /* Introduced in FFMS_VERSION ((2 << 24) | (17 << 16) | (1 << 8) | 3) */
+FFMS_API(void) FFMS_CancelProgressive(FFMS_VideoSource *V); /* Introduced in FFMS_VERSION ((2 << 24) | (17 << 16) | (1 << 8) | 3) */
+FFMS_API(int) FFMS_GetFramesAsync(FFMS_VideoSource *V, const int *Frames, int NumFrames, TFrameCallback FC, void *Private, FFMS_ErrorInfo *ErrorInfo); /* Introduced in FFMS_VERSION ((2 << 24) | (17 << 16) | (1 << 8) | 3) */
+FFMS_API(int) FFMS_WaitAsync(FFMS_VideoSource *V, FFMS_ErrorInfo *ErrorInfo); /* Introduced in FFMS_VERSION ((2 << 24) | (17 << 16) | (1 << 8) | 3) */
+FFMS_API(void) FFMS_CancelAsync(FFMS_VideoSource *V); /* Introduced in FFMS_VERSION ((2 << 24) | (17 << 16) | (1 << 8) | 3) */
 FFMS_API(int) FFMS_GetAudio(FFMS_AudioSource *A, void *Buf, int64_t Start, int64_t Count, FFMS_ErrorInfo *ErrorInfo);
 FFMS_DEPRECATED_API(int) FFMS_SetOutputFormatV(FFMS_VideoSource *V, int64_t TargetFormats, int Width, int Height, int Resizer, FFMS_ErrorInfo *ErrorInfo);
 FFMS_API(int) FFMS_SetOutputFormatV2(FFMS_VideoSource *V, const int *TargetFormats, int Width, int Height, int Resizer, FFMS_ErrorInfo *ErrorInfo); /* Introduced in FFMS_VERSION ((2 << 24) | (15 << 16) | (3 << 8) | 0) */
 FFMS_API(void) FFMS_ResetOutputFormatV(FFMS_VideoSource *V);
+FFMS_API(int) FFMS_SetCropV(FFMS_VideoSource *V, int Left, int Top, int Right, int Bottom, FFMS_ErrorInfo *ErrorInfo); /* Introduced in FFMS_VERSION ((2 << 24) | (17 << 16) | (1 << 8) | 3) */
+FFMS_API(int) FFMS_AddOutputFormatV(FFMS_VideoSource *V, const int *TargetFormats, int Width, int Height, int Resizer, int Cascade, FFMS_ErrorInfo *ErrorInfo); /* Introduced in FFMS_VERSION ((2 << 24) | (17 << 16) | (1 << 8) | 3) */
+FFMS_API(const FFMS_Frame *) FFMS_GetOutputFrameV(FFMS_VideoSource *V, int Output, FFMS_ErrorInfo *ErrorInfo); /* Introduced in FFMS_VERSION ((2 << 24) | (17 << 16) | (1 << 8) | 3) */
+FFMS_API(void) FFMS_ResetExtraOutputsV(FFMS_VideoSource *V); /* Introduced in FFMS_VERSION ((2 << 24) | (17 << 16) | (1 << 8) | 3) */
 FFMS_API(int) FFMS_SetInputFormatV(FFMS_VideoSource *V, int ColorSpace, int ColorRange, int Format, FFMS_ErrorInfo *ErrorInfo); /* Introduced in FFMS_VERSION ((2 << 24) | (17 << 16) | (1 << 8) | 0) */
 FFMS_API(void) FFMS_ResetInputFormatV(FFMS_VideoSource *V);
+FFMS_API(int) FFMS_SetAnchorCacheV(FFMS_VideoSource *V, int Interval, int64_t MaxSize, FFMS_ErrorInfo *ErrorInfo); /* Introduced in FFMS_VERSION ((2 << 24) | (17 << 16) | (1 << 8) | 3) */
+FFMS_API(int) FFMS_SetPacketCacheV(FFMS_VideoSource *V, int64_t MaxSize, FFMS_ErrorInfo *ErrorInfo); /* Introduced in FFMS_VERSION ((2 << 24) | (17 << 16) | (1 << 8) | 3) */
 FFMS_DEPRECATED_API(int) FFMS_SetPP(FFMS_VideoSource *V, const char *PP, FFMS_ErrorInfo *ErrorInfo);
 FFMS_DEPRECATED_API(void) FFMS_ResetPP(FFMS_VideoSource *V);
 FFMS_API(void) FFMS_DestroyIndex(FFMS_Index *Index);
@@ -334,6 +391,7 @@ FFMS_API(const char *) FFMS_GetCodecNameI(FFMS_Indexer *Indexer, int Track);
 FFMS_API(const char *) FFMS_GetFormatNameI(FFMS_Indexer *Indexer);
 FFMS_API(int) FFMS_GetNumFrames(FFMS_Track *T);
 FFMS_API(const FFMS_FrameInfo *) FFMS_GetFrameInfo(FFMS_Track *T, int Frame);
+FFMS_API(int) FFMS_GetClosestFrameFromTime(FFMS_Track *T, double Time); /* Introduced in FFMS_VERSION ((2 << 24) | (17 << 16) | (1 << 8) | 3) */
 FFMS_API(FFMS_Track *) FFMS_GetTrackFromIndex(FFMS_Index *Index, int Track);
 FFMS_API(FFMS_Track *) FFMS_GetTrackFromVideo(FFMS_VideoSource *V);
 FFMS_API(FFMS_Track *) FFMS_GetTrackFromAudio(FFMS_AudioSource *A);
@@ -349,6 +407,8 @@ FFMS_API(FFMS_Index *) FFMS_ReadIndex(const char *IndexFile, FFMS_ErrorInfo *Err
 FFMS_API(int) FFMS_IndexBelongsToFile(FFMS_Index *Index, const char *SourceFile, FFMS_ErrorInfo *ErrorInfo);
 FFMS_API(int) FFMS_WriteIndex(const char *IndexFile, FFMS_Index *Index, FFMS_ErrorInfo *ErrorInfo);
 FFMS_API(int) FFMS_GetPixFmt(const char *Name);
+FFMS_API(void) FFMS_SetBufferPool(int64_t MaxCached, int UseHugePages); /* Introduced in FFMS_VERSION ((2 << 24) | (17 << 16) | (1 << 8) | 3) */
+FFMS_API(void) FFMS_GetBufferPoolStats(FFMS_BufferPoolStats *Stats); /* Introduced in FFMS_VERSION ((2 << 24) | (17 << 16) | (1 << 8) | 3) */
 FFMS_API(int) FFMS_GetPresentSources();
 FFMS_API(int) FFMS_GetEnabledSources();
 
@@ -275,6 +275,27 @@ void AvisynthVideoSource::InitOutputFormat(
 	if (RFFMode > 0) {
 		VI.height -= VI.height & 1;
 	}
+
+	// Frames that weren't cropped above can be written directly to avisynth's frames
+	DirectOutput = VI.width == F->ScaledWidth && VI.height == F->ScaledHeight;
+	OutputPixelFormat = F->ConvertedPixelFormat;
+}
+
+void AvisynthVideoSource::GetDestination(PVideoFrame &Dst, uint8_t **Data, int *Linesize) {
+	if (VI.pixel_type == VideoInfo::CS_I420) {
+		Data[0] = Dst->GetWritePtr(PLANAR_Y);
+		Data[1] = Dst->GetWritePtr(PLANAR_U);
+		Data[2] = Dst->GetWritePtr(PLANAR_V);
+		Linesize[0] = Dst->GetPitch(PLANAR_Y);
+		Linesize[1] = Dst->GetPitch(PLANAR_U);
+		Linesize[2] = Dst->GetPitch(PLANAR_V);
+	} else if (VI.IsYUY2()) {
+		Data[0] = Dst->GetWritePtr();
+		Linesize[0] = Dst->GetPitch();
+	} else { // RGB
+		Data[0] = Dst->GetWritePtr() + Dst->GetPitch() * (Dst->GetHeight() - 1);
+		Linesize[0] = -Dst->GetPitch();
+	}
 }
 
 void AvisynthVideoSource::OutputFrame(const FFMS_Frame *Frame, PVideoFrame &Dst, IScriptEnvironment *Env) {
@@ -315,6 +336,38 @@ void AvisynthVideoSource::OutputField(const FFMS_Frame *Frame, PVideoFrame &Dst,
 	}
 }
 
+// Writes one field of frame n to every other line of Dst. The core converts
+// only the field, the whole frame is only fetched when the picture can't be
+// split into fields.
+void AvisynthVideoSource::OutputField(int n, PVideoFrame &Dst, int Field, IScriptEnvironment *Env) {
+	char ErrorMsg[1024];
+	FFMS_ErrorInfo E;
+	E.Buffer = ErrorMsg;
+	E.BufferSize = sizeof(ErrorMsg);
+
+	const FFMS_Frame *Frame = FFMS_GetFrameField(V, n, Field ? FFMS_FIELD_TOP : FFMS_FIELD_BOTTOM, &E);
+	if (Frame == NULL || Frame->ScaledWidth != VI.width || Frame->ScaledHeight * 2 != VI.height) {
+		Frame = FFMS_GetFrame(V, n, &E);
+		if (Frame == NULL)
+			Env->ThrowError("FFVideoSource: %s", E.Buffer);
+		OutputField(Frame, Dst, Field, Env);
+		LastPictType = Frame->PictType;
+		return;
+	}
+
+	LastPictType = Frame->PictType;
+
+	if (VI.pixel_type == VideoInfo::CS_I420) {
+		int Planes[3] = { PLANAR_Y, PLANAR_U, PLANAR_V };
+		for (int i = 0; i < 3; i++)
+			Env->BitBlt(Dst->GetWritePtr(Planes[i]) + (Field ? 0 : Dst->GetPitch(Planes[i])), Dst->GetPitch(Planes[i]) * 2, Frame->Data[i], Frame->Linesize[i], Dst->GetRowSize(Planes[i]), Dst->GetHeight(Planes[i]) / 2);
+	} else if (VI.IsYUY2()) {
+		Env->BitBlt(Dst->GetWritePtr() + (Field ? 0 : Dst->GetPitch()), Dst->GetPitch() * 2, Frame->Data[0], Frame->Linesize[0], Dst->GetRowSize(), Dst->GetHeight() / 2);
+	} else { // RGB
+		Env->BitBlt(Dst->GetWritePtr() + Dst->GetPitch() * (Dst->GetHeight() - (Field ? 1 : 2)), -Dst->GetPitch() * 2, Frame->Data[0], Frame->Linesize[0], Dst->GetRowSize(), Dst->GetHeight() / 2);
+	}
+}
+
 PVideoFrame AvisynthVideoSource::GetFrame(int n, IScriptEnvironment *Env) {
 	n = FFMIN(FFMAX(n,0), VI.num_frames - 1);
 
@@ -323,43 +376,56 @@ PVideoFrame AvisynthVideoSource::GetFrame(int n, IScriptEnvironment *Env) {
 	E.Buffer = ErrorMsg;
 	E.BufferSize = sizeof(ErrorMsg);
 
-	PVideoFrame Dst = Env->NewVideoFrame(VI);
-
+	FrameFields Fields;
 	if (RFFMode > 0) {
-		const FFMS_Frame *Frame = FFMS_GetFrame(V, FFMIN(FieldList[n].Top, FieldList[n].Bottom), &E);
-		if (Frame == NULL)
-			Env->ThrowError("FFVideoSource: %s", E.Buffer);
-		if (FieldList[n].Top == FieldList[n].Bottom) {
-			OutputFrame(Frame, Dst, Env);
+		Fields = FieldList[n];
+	} else if (FPSNum > 0 && FPSDen > 0) {
+		Fields.Top = FFMS_GetClosestFrameFromTime(FFMS_GetTrackFromVideo(V), FFMS_GetVideoProperties(V)->FirstTime +
+			(double)(n * (int64_t)FPSDen) / FPSNum);
+		Fields.Bottom = Fields.Top;
+	} else {
+		Fields.Top = n;
+		Fields.Bottom = n;
+		FFMS_Track *T = FFMS_GetTrackFromVideo(V);
+		const FFMS_TrackTimeBase *TB = FFMS_GetTimeBase(T);
+		Env->SetVar(Env->Sprintf("%s%s", this->VarPrefix, "FFVFR_TIME"), static_cast<int>(FFMS_GetFrameInfo(T, n)->PTS * static_cast<double>(TB->Num) / TB->Den));
+	}
+
+	// Changing the frame rate repeats source frames, which don't have to be
+	// decoded, converted and copied again each time
+	if (!LastOutput || Fields.Top != LastFields.Top || Fields.Bottom != LastFields.Bottom) {
+		PVideoFrame Dst = Env->NewVideoFrame(VI);
+
+		if (Fields.Top != Fields.Bottom) {
+			int FirstField = FFMIN(Fields.Top, Fields.Bottom) == Fields.Bottom;
+			OutputField(FFMIN(Fields.Top, Fields.Bottom), Dst, FirstField, Env);
+			OutputField(FFMAX(Fields.Top, Fields.Bottom), Dst, !FirstField, Env);
 		} else {
-			int FirstField = FFMIN(FieldList[n].Top, FieldList[n].Bottom) == FieldList[n].Bottom;
-			OutputField(Frame, Dst, FirstField, Env);
-			Frame = FFMS_GetFrame(V, FFMAX(FieldList[n].Top, FieldList[n].Bottom), &E);
+			const FFMS_Frame *Frame;
+			if (DirectOutput) {
+				uint8_t *Data[4] = {};
+				int Linesize[4] = {};
+				GetDestination(Dst, Data, Linesize);
+				Frame = FFMS_GetFrameInto(V, Fields.Top, Data, Linesize, OutputPixelFormat, VI.width, VI.height, &E);
+			} else {
+				Frame = FFMS_GetFrame(V, Fields.Top, &E);
+			}
+
 			if (Frame == NULL)
 				Env->ThrowError("FFVideoSource: %s", E.Buffer);
-			OutputField(Frame, Dst, !FirstField, Env);
-		}
-	} else {
-		const FFMS_Frame *Frame;
 
-		if (FPSNum > 0 && FPSDen > 0) {
-			Frame = FFMS_GetFrameByTime(V, FFMS_GetVideoProperties(V)->FirstTime +
-				(double)(n * (int64_t)FPSDen) / FPSNum, &E);
-		} else {
-			Frame = FFMS_GetFrame(V, n, &E);
-			FFMS_Track *T = FFMS_GetTrackFromVideo(V);
-			const FFMS_TrackTimeBase *TB = FFMS_GetTimeBase(T);
-			Env->SetVar(Env->Sprintf("%s%s", this->VarPrefix, "FFVFR_TIME"), static_cast<int>(FFMS_GetFrameInfo(T, n)->PTS * static_cast<double>(TB->Num) / TB->Den));
+			if (!DirectOutput)
+				OutputFrame(Frame, Dst, Env);
+			LastPictType = Frame->PictType;
 		}
 
-		if (Frame == NULL)
-			Env->ThrowError("FFVideoSource: %s", E.Buffer);
-
-		Env->SetVar(Env->Sprintf("%s%s", this->VarPrefix, "FFPICT_TYPE"), static_cast<int>(Frame->PictType));
-		OutputFrame(Frame, Dst, Env);
+		LastOutput = Dst;
+		LastFields = Fields;
 	}
 
-	return Dst;
+	Env->SetVar(Env->Sprintf("%s%s", this->VarPrefix, "FFPICT_TYPE"), LastPictType);
+
+	return LastOutput;
 }
 
 bool AvisynthVideoSource::GetParity(int n) {
@@ -42,11 +42,20 @@ private:
 	int RFFMode;
 	std::vector<FrameFields> FieldList;
 	const char *VarPrefix;
+	bool DirectOutput;
+	int OutputPixelFormat;
+	// The last output frame and the source frames it was made from, which
+	// is returned again when the next output frame uses the same ones
+	PVideoFrame LastOutput;
+	FrameFields LastFields;
+	int LastPictType;
 
 	void InitOutputFormat(int ResizeToWidth, int ResizeToHeight,
 		const char *ResizerName, const char *ConvertToFormatName, IScriptEnvironment *Env);
+	void GetDestination(PVideoFrame &Dst, uint8_t **Data, int *Linesize);
 	void OutputFrame(const FFMS_Frame *Frame, PVideoFrame &Dst, IScriptEnvironment *Env);
 	void OutputField(const FFMS_Frame *Frame, PVideoFrame &Dst, int Field, IScriptEnvironment *Env);
+	void OutputField(int n, PVideoFrame &Dst, int Field, IScriptEnvironment *Env);
 public:
 	AvisynthVideoSource(const char *SourceFile, int Track, FFMS_Index *Index,
 		int FPSNum, int FPSDen, const char *PP, int Threads, int SeekMode, int RFFMode,
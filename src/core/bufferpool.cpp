@@ -0,0 +1,162 @@
+//  Copyright (c) 2012 Fredrik Mellbin
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#include "bufferpool.h"
+#include "threading.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#if defined(__linux__)
+#	include <sys/mman.h>
+#endif
+
+extern "C" {
+#include <libavutil/mem.h>
+}
+
+#define MIN_BLOCK_CLASS 48 // 4 kB
+#define NUM_BLOCK_CLASSES 120 // up to 896 MB
+#define BLOCK_HEADER_SIZE 64 // keeps the alignment av_malloc gives
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#define DEFAULT_MAX_CACHED 0 // of freed blocks, nothing is kept unless FFMS_SetBufferPool asks for it
+
+struct BlockHeader {
+	int Class;
+	bool Huge;
+};
+
+// There are four classes for every power of two, so a block is never more
+// than 25% larger than what was asked for
+static size_t ClassSize(int Class) {
+	return (static_cast<size_t>(4 + (Class & 3)) << (Class >> 2)) >> 2;
+}
+
+static FFMutex PoolLock;
+static std::vector<void *> FreeBlocks[NUM_BLOCK_CLASSES];
+// Only caps the free lists, allocations always succeed as long as the system has memory
+static int64_t MaxCachedBytes = DEFAULT_MAX_CACHED;
+static bool HugePages = false;
+static FFMS_BufferPoolStats Stats;
+
+static void *AllocateBlock(size_t Size, bool &Huge) {
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+	if (HugePages && Size >= HUGE_PAGE_SIZE) {
+		void *Block = NULL;
+		if (!posix_memalign(&Block, HUGE_PAGE_SIZE, Size)) {
+			madvise(Block, Size, MADV_HUGEPAGE);
+			Huge = true;
+			return Block;
+		}
+	}
+#endif
+	Huge = false;
+	return av_malloc(Size);
+}
+
+static void FreeBlock(void *Block) {
+	if (static_cast<BlockHeader *>(Block)->Huge)
+		free(Block);
+	else
+		av_free(Block);
+}
+
+// PoolLock must be held
+static void TrimCache() {
+	for (int i = NUM_BLOCK_CLASSES - 1; i >= 0 && Stats.BytesCached > MaxCachedBytes; i--) {
+		while (!FreeBlocks[i].empty() && Stats.BytesCached > MaxCachedBytes) {
+			FreeBlock(FreeBlocks[i].back());
+			FreeBlocks[i].pop_back();
+			Stats.BytesCached -= ClassSize(i);
+		}
+	}
+}
+
+void *PoolAlloc(size_t Size) {
+	int Class = MIN_BLOCK_CLASS;
+	while (Class < NUM_BLOCK_CLASSES && ClassSize(Class) < Size + BLOCK_HEADER_SIZE)
+		Class++;
+	if (Class == NUM_BLOCK_CLASSES)
+		return NULL;
+
+	FFScopedLock L(PoolLock);
+	void *Block;
+	if (!FreeBlocks[Class].empty()) {
+		Block = FreeBlocks[Class].back();
+		FreeBlocks[Class].pop_back();
+		Stats.BytesCached -= ClassSize(Class);
+		Stats.Hits++;
+	} else {
+		bool Huge;
+		Block = AllocateBlock(ClassSize(Class), Huge);
+		if (!Block)
+			return NULL;
+		static_cast<BlockHeader *>(Block)->Class = Class;
+		static_cast<BlockHeader *>(Block)->Huge = Huge;
+		Stats.Misses++;
+	}
+	Stats.BytesInUse += ClassSize(Class);
+	return static_cast<uint8_t *>(Block) + BLOCK_HEADER_SIZE;
+}
+
+void PoolFree(void *Data) {
+	if (!Data)
+		return;
+
+	void *Block = static_cast<uint8_t *>(Data) - BLOCK_HEADER_SIZE;
+	int Class = static_cast<BlockHeader *>(Block)->Class;
+
+	FFScopedLock L(PoolLock);
+	Stats.BytesInUse -= ClassSize(Class);
+	FreeBlocks[Class].push_back(Block);
+	Stats.BytesCached += ClassSize(Class);
+	TrimCache();
+}
+
+int PoolPictureAlloc(AVPicture *Picture, PixelFormat Format, int Width, int Height) {
+	memset(Picture, 0, sizeof(*Picture));
+	int Size = avpicture_get_size(Format, Width, Height);
+	if (Size < 0)
+		return -1;
+
+	uint8_t *Data = static_cast<uint8_t *>(PoolAlloc(Size));
+	if (!Data)
+		return -1;
+	avpicture_fill(Picture, Data, Format, Width, Height);
+	return 0;
+}
+
+void PoolPictureFree(AVPicture *Picture) {
+	PoolFree(Picture->data[0]);
+	memset(Picture, 0, sizeof(*Picture));
+}
+
+void SetBufferPool(int64_t MaxCached, bool UseHugePages) {
+	FFScopedLock L(PoolLock);
+	MaxCachedBytes = MaxCached;
+	HugePages = UseHugePages;
+	TrimCache();
+}
+
+void GetBufferPoolStats(FFMS_BufferPoolStats *Stats) {
+	FFScopedLock L(PoolLock);
+	*Stats = ::Stats;
+}
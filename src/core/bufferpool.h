@@ -0,0 +1,45 @@
+//  Copyright (c) 2012 Fredrik Mellbin
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+}
+
+#include "ffms.h"
+
+// Picture memory shared by every source in the process. Freed blocks are
+// kept in size classes and handed out again to whoever needs a block of
+// about the same size, instead of going back to the system. Blocks larger
+// than 896 MB can't be allocated.
+void *PoolAlloc(size_t Size);
+void PoolFree(void *Block);
+
+// Drop-in replacements for avpicture_alloc and avpicture_free
+int PoolPictureAlloc(AVPicture *Picture, PixelFormat Format, int Width, int Height);
+void PoolPictureFree(AVPicture *Picture);
+
+// MaxCached caps how much freed memory is kept for reuse, the memory in use isn't limited
+void SetBufferPool(int64_t MaxCached, bool UseHugePages);
+void GetBufferPoolStats(FFMS_BufferPoolStats *Stats);
+
+#endif
@@ -25,6 +25,7 @@
 #include "videosource.h"
 #include "audiosource.h"
 #include "indexing.h"
+#include "bufferpool.h"
 
 extern "C" {
 #include <libavutil/pixdesc.h>
@@ -124,20 +125,24 @@ FFMS_API(void) FFMS_SetLogLevel(int Level) {
 }
 
 FFMS_API(FFMS_VideoSource *) FFMS_CreateVideoSource(const char *SourceFile, int Track, FFMS_Index *Index, int Threads, int SeekMode, FFMS_ErrorInfo *ErrorInfo) {
+	return FFMS_CreateVideoSource2(SourceFile, Track, Index, Threads, SeekMode, 0, ErrorInfo);
+}
+
+FFMS_API(FFMS_VideoSource *) FFMS_CreateVideoSource2(const char *SourceFile, int Track, FFMS_Index *Index, int Threads, int SeekMode, int Flags, FFMS_ErrorInfo *ErrorInfo) {
 	try {
 		switch (Index->Decoder) {
 			case FFMS_SOURCE_LAVF:
-				return new FFLAVFVideo(SourceFile, Track, *Index, Threads, SeekMode);
+				return new FFLAVFVideo(SourceFile, Track, *Index, Threads, SeekMode, Flags);
 			case FFMS_SOURCE_MATROSKA:
-				return new FFMatroskaVideo(SourceFile, Track, *Index, Threads);
+				return new FFMatroskaVideo(SourceFile, Track, *Index, Threads, Flags);
 #ifdef HAALISOURCE
 			case FFMS_SOURCE_HAALIMPEG:
 				if (HasHaaliMPEG)
-					return new FFHaaliVideo(SourceFile, Track, *Index, Threads, FFMS_SOURCE_HAALIMPEG);
+					return new FFHaaliVideo(SourceFile, Track, *Index, Threads, FFMS_SOURCE_HAALIMPEG, Flags);
 				throw FFMS_Exception(FFMS_ERROR_PARSER, FFMS_ERROR_NOT_AVAILABLE, "Haali MPEG/TS source unavailable");
 			case FFMS_SOURCE_HAALIOGG:
 				if (HasHaaliOGG)
-					return new FFHaaliVideo(SourceFile, Track, *Index, Threads, FFMS_SOURCE_HAALIOGG);
+					return new FFHaaliVideo(SourceFile, Track, *Index, Threads, FFMS_SOURCE_HAALIOGG, Flags);
 				throw FFMS_Exception(FFMS_ERROR_PARSER, FFMS_ERROR_NOT_AVAILABLE, "Haali OGG/OGM source unavailable");
 #endif
 			default: 
@@ -201,6 +206,60 @@ FFMS_API(const FFMS_Frame *) FFMS_GetFrame(FFMS_VideoSource *V, int n, FFMS_Erro
 	}
 }
 
+FFMS_API(const FFMS_Frame *) FFMS_GetFrameInto(FFMS_VideoSource *V, int n, uint8_t *const *Data, const int *Linesize, int Format, int Width, int Height, FFMS_ErrorInfo *ErrorInfo) {
+	ClearErrorInfo(ErrorInfo);
+	try {
+		return V->GetFrameInto(n, Data, Linesize, (PixelFormat)Format, Width, Height);
+	} catch (FFMS_Exception &e) {
+		e.CopyOut(ErrorInfo);
+		return NULL;
+	}
+}
+
+FFMS_API(const FFMS_Frame *) FFMS_GetFrameRef(FFMS_VideoSource *V, int n, FFMS_ErrorInfo *ErrorInfo) {
+	ClearErrorInfo(ErrorInfo);
+	try {
+		return V->GetFrameRef(n);
+	} catch (FFMS_Exception &e) {
+		e.CopyOut(ErrorInfo);
+		return NULL;
+	}
+}
+
+FFMS_API(int) FFMS_AddFrameRef(const FFMS_Frame *Frame, FFMS_ErrorInfo *ErrorInfo) {
+	ClearErrorInfo(ErrorInfo);
+	try {
+		FFMS_VideoSource::AddFrameRef(Frame);
+	} catch (FFMS_Exception &e) {
+		return e.CopyOut(ErrorInfo);
+	}
+	return FFMS_ERROR_SUCCESS;
+}
+
+FFMS_API(int) FFMS_ReleaseFrame(const FFMS_Frame *Frame, FFMS_ErrorInfo *ErrorInfo) {
+	ClearErrorInfo(ErrorInfo);
+	try {
+		FFMS_VideoSource::ReleaseFrameRef(Frame);
+	} catch (FFMS_Exception &e) {
+		return e.CopyOut(ErrorInfo);
+	}
+	return FFMS_ERROR_SUCCESS;
+}
+
+FFMS_API(void) FFMS_SetFrameRefLimitV(FFMS_VideoSource *V, int MaxFrames) {
+	V->SetFrameRefLimit(MaxFrames);
+}
+
+FFMS_API(const FFMS_Frame *) FFMS_GetFrameField(FFMS_VideoSource *V, int n, int Field, FFMS_ErrorInfo *ErrorInfo) {
+	ClearErrorInfo(ErrorInfo);
+	try {
+		return V->GetFrameField(n, Field);
+	} catch (FFMS_Exception &e) {
+		e.CopyOut(ErrorInfo);
+		return NULL;
+	}
+}
+
 FFMS_API(const FFMS_Frame *) FFMS_GetFrameByTime(FFMS_VideoSource *V, double Time, FFMS_ErrorInfo *ErrorInfo) {
 	ClearErrorInfo(ErrorInfo);
 	try {
@@ -211,6 +270,84 @@ FFMS_API(const FFMS_Frame *) FFMS_GetFrameByTime(FFMS_VideoSource *V, double Tim
 	}
 }
 
+FFMS_API(const FFMS_Frame *) FFMS_GetNearestKeyFrame(FFMS_VideoSource *V, int n, int *KeyFrame, FFMS_ErrorInfo *ErrorInfo) {
+	ClearErrorInfo(ErrorInfo);
+	try {
+		return V->GetNearestKeyFrame(n, KeyFrame);
+	} catch (FFMS_Exception &e) {
+		e.CopyOut(ErrorInfo);
+		return NULL;
+	}
+}
+
+FFMS_API(const FFMS_Frame *) FFMS_GetNearestKeyFrameByTime(FFMS_VideoSource *V, double Time, int *KeyFrame, FFMS_ErrorInfo *ErrorInfo) {
+	ClearErrorInfo(ErrorInfo);
+	try {
+		return V->GetNearestKeyFrameByTime(Time, KeyFrame);
+	} catch (FFMS_Exception &e) {
+		e.CopyOut(ErrorInfo);
+		return NULL;
+	}
+}
+
+FFMS_API(int) FFMS_GetFrames(FFMS_VideoSource *V, const int *Frames, int NumFrames, TFrameCallback FC, void *Private, FFMS_ErrorInfo *ErrorInfo) {
+	ClearErrorInfo(ErrorInfo);
+	try {
+		V->GetFrames(Frames, NumFrames, FC, Private);
+	} catch (FFMS_Exception &e) {
+		return e.CopyOut(ErrorInfo);
+	}
+	return FFMS_ERROR_SUCCESS;
+}
+
+FFMS_API(int) FFMS_GetFramesTensor(FFMS_VideoSource *V, const int *Frames, int NumFrames, void *Tensor, int Width, int Height, int Type, const float *Mean, const float *Std, FFMS_ErrorInfo *ErrorInfo) {
+	ClearErrorInfo(ErrorInfo);
+	try {
+		V->GetFramesTensor(Frames, NumFrames, Tensor, Width, Height, Type, Mean, Std);
+	} catch (FFMS_Exception &e) {
+		return e.CopyOut(ErrorInfo);
+	}
+	return FFMS_ERROR_SUCCESS;
+}
+
+FFMS_API(const FFMS_Frame *) FFMS_GetFrameProgressive(FFMS_VideoSource *V, int n, int MaxDecode, int *FrameNum, TExactFrameCallback EFC, void *Private, FFMS_ErrorInfo *ErrorInfo) {
+	ClearErrorInfo(ErrorInfo);
+	try {
+		return V->GetFrameProgressive(n, MaxDecode, FrameNum, EFC, Private);
+	} catch (FFMS_Exception &e) {
+		e.CopyOut(ErrorInfo);
+		return NULL;
+	}
+}
+
+FFMS_API(void) FFMS_CancelProgressive(FFMS_VideoSource *V) {
+	V->CancelProgressive();
+}
+
+FFMS_API(int) FFMS_GetFramesAsync(FFMS_VideoSource *V, const int *Frames, int NumFrames, TFrameCallback FC, void *Private, FFMS_ErrorInfo *ErrorInfo) {
+	ClearErrorInfo(ErrorInfo);
+	try {
+		V->GetFramesAsync(Frames, NumFrames, FC, Private);
+	} catch (FFMS_Exception &e) {
+		return e.CopyOut(ErrorInfo);
+	}
+	return FFMS_ERROR_SUCCESS;
+}
+
+FFMS_API(int) FFMS_WaitAsync(FFMS_VideoSource *V, FFMS_ErrorInfo *ErrorInfo) {
+	ClearErrorInfo(ErrorInfo);
+	try {
+		V->WaitAsync();
+	} catch (FFMS_Exception &e) {
+		return e.CopyOut(ErrorInfo);
+	}
+	return FFMS_ERROR_SUCCESS;
+}
+
+FFMS_API(void) FFMS_CancelAsync(FFMS_VideoSource *V) {
+	V->CancelAsync();
+}
+
 FFMS_API(int) FFMS_GetAudio(FFMS_AudioSource *A, void *Buf, int64_t Start, int64_t Count, FFMS_ErrorInfo *ErrorInfo) {
 	ClearErrorInfo(ErrorInfo);
 	try {
@@ -244,6 +381,40 @@ FFMS_API(void) FFMS_ResetOutputFormatV(FFMS_VideoSource *V) {
 	V->ResetOutputFormat();
 }
 
+FFMS_API(int) FFMS_SetCropV(FFMS_VideoSource *V, int Left, int Top, int Right, int Bottom, FFMS_ErrorInfo *ErrorInfo) {
+	ClearErrorInfo(ErrorInfo);
+	try {
+		V->SetCrop(Left, Top, Right, Bottom);
+	} catch (FFMS_Exception &e) {
+		return e.CopyOut(ErrorInfo);
+	}
+	return FFMS_ERROR_SUCCESS;
+}
+
+FFMS_API(int) FFMS_AddOutputFormatV(FFMS_VideoSource *V, const int *TargetFormats, int Width, int Height, int Resizer, int Cascade, FFMS_ErrorInfo *ErrorInfo) {
+	ClearErrorInfo(ErrorInfo);
+	try {
+		return V->AddOutputFormat(reinterpret_cast<const PixelFormat *>(TargetFormats), Width, Height, Resizer, !!Cascade);
+	} catch (FFMS_Exception &e) {
+		e.CopyOut(ErrorInfo);
+		return -1;
+	}
+}
+
+FFMS_API(const FFMS_Frame *) FFMS_GetOutputFrameV(FFMS_VideoSource *V, int Output, FFMS_ErrorInfo *ErrorInfo) {
+	ClearErrorInfo(ErrorInfo);
+	try {
+		return V->GetOutputFrame(Output);
+	} catch (FFMS_Exception &e) {
+		e.CopyOut(ErrorInfo);
+		return NULL;
+	}
+}
+
+FFMS_API(void) FFMS_ResetExtraOutputsV(FFMS_VideoSource *V) {
+	V->ResetExtraOutputs();
+}
+
 FFMS_API(int) FFMS_SetInputFormatV(FFMS_VideoSource *V, int ColorSpace, int ColorRange, int Format, FFMS_ErrorInfo *ErrorInfo) {
 	ClearErrorInfo(ErrorInfo);
 	try {
@@ -258,6 +429,26 @@ FFMS_API(void) FFMS_ResetInputFormatV(FFMS_VideoSource *V) {
 	V->ResetInputFormat();
 }
 
+FFMS_API(int) FFMS_SetAnchorCacheV(FFMS_VideoSource *V, int Interval, int64_t MaxSize, FFMS_ErrorInfo *ErrorInfo) {
+	ClearErrorInfo(ErrorInfo);
+	try {
+		V->SetAnchorCache(Interval, MaxSize);
+	} catch (FFMS_Exception &e) {
+		return e.CopyOut(ErrorInfo);
+	}
+	return FFMS_ERROR_SUCCESS;
+}
+
+FFMS_API(int) FFMS_SetPacketCacheV(FFMS_VideoSource *V, int64_t MaxSize, FFMS_ErrorInfo *ErrorInfo) {
+	ClearErrorInfo(ErrorInfo);
+	try {
+		V->SetPacketCache(MaxSize);
+	} catch (FFMS_Exception &e) {
+		return e.CopyOut(ErrorInfo);
+	}
+	return FFMS_ERROR_SUCCESS;
+}
+
 FFMS_API(int) FFMS_SetPP(FFMS_VideoSource *V, const char *PP, FFMS_ErrorInfo *ErrorInfo) {
 	ClearErrorInfo(ErrorInfo);
 	try {
@@ -340,6 +531,10 @@ FFMS_API(const FFMS_FrameInfo *) FFMS_GetFrameInfo(FFMS_Track *T, int Frame) {
 	return &(*T)[Frame];
 }
 
+FFMS_API(int) FFMS_GetClosestFrameFromTime(FFMS_Track *T, double Time) {
+	return T->ClosestFrameFromTime(Time);
+}
+
 FFMS_API(FFMS_Track *) FFMS_GetTrackFromIndex(FFMS_Index *Index, int Track) {
 	return &(*Index)[Track];
 }
@@ -482,6 +677,14 @@ FFMS_API(int) FFMS_GetPixFmt(const char *Name) {
 	return av_get_pix_fmt(Name);
 }
 
+FFMS_API(void) FFMS_SetBufferPool(int64_t MaxCached, int UseHugePages) {
+	SetBufferPool(MaxCached, !!UseHugePages);
+}
+
+FFMS_API(void) FFMS_GetBufferPoolStats(FFMS_BufferPoolStats *Stats) {
+	GetBufferPoolStats(Stats);
+}
+
 
 FFMS_API(int) FFMS_GetPresentSources() {
 	int Sources = FFMS_SOURCE_LAVF | FFMS_SOURCE_MATROSKA;
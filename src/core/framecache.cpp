@@ -0,0 +1,332 @@
+//  Copyright (c) 2012 Fredrik Mellbin
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#include "videosource.h"
+#include "bufferpool.h"
+
+#define MAX_REVERSE_BUFFER_SIZE (128 * 1024 * 1024)
+
+FFMS_Frame *FFMS_VideoSource::GetCachedFrame(int n) {
+	if (FillingReverseBuffer)
+		return NULL;
+
+	int Previous = LastRequested;
+	LastRequested = n;
+
+	// The last frame is output again when it has to go to a caller's buffer,
+	// LocalFrame still points into one, holds a field instead of a frame or
+	// the conversion into it failed
+	if (n == LastFrameNum && (DirectData || LocalFrameDirect || LocalFrame.Field != TargetField || !LastOutputFrame))
+		return OutputFrame(DecodeFrame);
+
+	int Offset = n - ReverseBufferStart;
+	if (Offset < 0 || Offset >= static_cast<int>(ReverseBuffer.size()) || !ReverseBuffer[Offset] || !PictureUsable(ReverseBuffer[Offset])) {
+		if (n != LastFrameNum && NearestAnchor(n) == n)
+			return OutputAnchor(n);
+
+		// Stepping back a little into a GOP which would otherwise have to be
+		// decoded again from the keyframe for every single frame
+		if (n >= Previous || n < Previous - 4 || n == LastFrameNum || Frames[n].KeyFrame || !PictureUsable(NULL)) {
+			ClearReverseBuffer();
+			return NULL;
+		}
+
+		FillReverseBuffer(n);
+		Offset = n - ReverseBufferStart;
+
+		// The decoder is at n either way, but may not have kept the picture
+		if (!ReverseBuffer[Offset])
+			return OutputFrame(DecodeFrame);
+	}
+
+	// LocalFrame no longer comes from DecodeFrame
+	LastFrameNum = -1;
+	return OutputFrame(ReverseBuffer[Offset]->Frame);
+}
+
+void FFMS_VideoSource::FillReverseBuffer(int n) {
+	ClearReverseBuffer();
+
+	// The pictures are kept the way the decoder output them and only
+	// converted when requested, which is both cheaper to fill and usually a
+	// lot smaller than the converted frames. Assume the decoder's output
+	// format won't change in the middle of the GOP.
+	int MaxFrames = FFMAX(1, MAX_REVERSE_BUFFER_SIZE / FFMAX(1, avpicture_get_size(CodecContext->pix_fmt, CodecContext->width, CodecContext->height)));
+
+	int Start = FFMAX(Frames.FindClosestVideoKeyFrame(n), n - MaxFrames + 1);
+	ReverseBufferStart = Start;
+	ReverseBuffer.assign(n - Start + 1, NULL);
+
+	// A single pass from the keyframe, where the decode loop copies the
+	// pictures as they come out with StoreReversePicture and nothing is
+	// converted
+	FillingReverseBuffer = true;
+	try {
+		GetFrame(n);
+	} catch (...) {
+		FillingReverseBuffer = false;
+		ClearReverseBuffer();
+		throw;
+	}
+	FillingReverseBuffer = false;
+}
+
+void FFMS_VideoSource::StoreReversePicture() {
+	int Offset = CurrentFrame - ReverseBufferStart;
+	if (!FillingReverseBuffer || Offset < 0 || Offset >= static_cast<int>(ReverseBuffer.size()))
+		return;
+
+	// Seeking again may decode the same frame twice
+	delete ReverseBuffer[Offset];
+	ReverseBuffer[Offset] = NULL;
+	ReverseBuffer[Offset] = new DecodedPicture(DecodeFrame, CodecContext->pix_fmt, CodecContext->width, CodecContext->height);
+}
+
+void FFMS_VideoSource::SetSkipFrame(int n) {
+	// Nothing that's output or kept may be skipped, and neither may anything
+	// within the decoder delay before it
+	FirstNeeded = FillingReverseBuffer ? FFMIN(ReverseBufferStart, n) : n;
+	if (InitialDecode == 1)
+		ExactDecode = true;
+	if (CurrentFrame + FFMS_CALCULATE_DELAY >= FirstNeeded) {
+		CodecContext->skip_frame = AVDISCARD_DEFAULT;
+	} else {
+		CodecContext->skip_frame = AVDISCARD_NONREF;
+		ExactDecode = false;
+	}
+}
+
+bool FFMS_VideoSource::CanDropPacket(int Frame) {
+	// Nothing refers to a non-reference frame, so only the ones that are
+	// output or kept have to be decoded at all
+	if (!Frames.HasReferenceInfo || Frame < 0 || Frame >= FirstNeeded || Frames[Frame].Reference)
+		return false;
+	if (CodecContext->skip_frame >= AVDISCARD_NONREF)
+		return true;
+
+	// Within the decoder delay the frames are counted by what the decoder
+	// outputs. Leaving out a B-frame doesn't change that when the decoder
+	// would have output it right away, which is the case when it reorders
+	// by at most one frame and doesn't use frame threads.
+	if (Frames[Frame].FrameType != AV_PICTURE_TYPE_B ||
+		CodecContext->has_b_frames > 1 || FFMS_CALCULATE_DELAY != CodecContext->has_b_frames)
+		return false;
+	ExactDecode = false;
+	return true;
+}
+
+void FFMS_VideoSource::ClearReverseBuffer() {
+	for (size_t i = 0; i < ReverseBuffer.size(); i++)
+		delete ReverseBuffer[i];
+	ReverseBuffer.clear();
+}
+
+void FFMS_VideoSource::SetAnchorCache(int Interval, int64_t MaxSize) {
+	if (Interval < 0 || MaxSize < 0)
+		throw FFMS_Exception(FFMS_ERROR_DECODING, FFMS_ERROR_INVALID_ARGUMENT,
+			"Invalid anchor cache settings");
+
+	ClearAnchors();
+	AnchorInterval = Interval;
+	MaxAnchorSize = MaxSize;
+}
+
+void FFMS_VideoSource::SetPacketCache(int64_t MaxSize) {
+	if (MaxSize < 0)
+		throw FFMS_Exception(FFMS_ERROR_DECODING, FFMS_ERROR_INVALID_ARGUMENT,
+			"Invalid packet cache size");
+
+	Packets.SetMaxSize(MaxSize);
+}
+
+void FFMS_VideoSource::StoreAnchor(int n) {
+	// Iterations which output nothing leave the previous picture behind
+	bool NewPicture = DecodedPictures != LastAnchorPicture;
+	LastAnchorPicture = DecodedPictures;
+	if (!NewPicture || AnchorInterval <= 0 || n % AnchorInterval || Anchors.count(n))
+		return;
+
+	// Once frames were skipped on the way what comes out only lines up with
+	// the frame numbers again from the first frame that is needed
+	if (!ExactDecode && n < FirstNeeded)
+		return;
+
+	int Size = avpicture_get_size(CodecContext->pix_fmt, CodecContext->width, CodecContext->height);
+	if (Size <= 0 || Size > MaxAnchorSize)
+		return;
+
+	// Anchors from before the frame size or format changed are useless
+	if (!Anchors.empty() && !PictureUsable(Anchors.begin()->second))
+		ClearAnchors();
+
+	// Evict whichever anchor is farthest away from where decoding is now
+	while (AnchorSize + Size > MaxAnchorSize) {
+		std::map<int, DecodedPicture *>::iterator Victim = Anchors.begin();
+		std::map<int, DecodedPicture *>::iterator Last = Anchors.end();
+		--Last;
+		if (Last->first - n > n - Victim->first)
+			Victim = Last;
+		AnchorSize -= Victim->second->Size;
+		delete Victim->second;
+		Anchors.erase(Victim);
+	}
+
+	// Running out of memory for an anchor isn't worth failing the frame over
+	try {
+		DecodedPicture *Anchor = new DecodedPicture(DecodeFrame, CodecContext->pix_fmt, CodecContext->width, CodecContext->height);
+		Anchors[n] = Anchor;
+		AnchorSize += Anchor->Size;
+	} catch (FFMS_Exception &) {
+	}
+}
+
+bool FFMS_VideoSource::PictureUsable(const DecodedPicture *Picture) {
+#ifdef FFMS_USE_POSTPROC
+	// The quantizer tables postprocessing needs aren't kept
+	if (PPMode)
+		return false;
+#endif // FFMS_USE_POSTPROC
+
+	// NULL only asks whether stored pictures can be output at all
+	return !Picture || (Picture->Format == CodecContext->pix_fmt &&
+		Picture->Width == CodecContext->width && Picture->Height == CodecContext->height);
+}
+
+int FFMS_VideoSource::NearestAnchor(int n) {
+	if (Anchors.empty() || !PictureUsable(Anchors.begin()->second))
+		return -1;
+
+	// Anything from before the keyframe looks nothing like n after a cut
+	std::map<int, DecodedPicture *>::iterator It = Anchors.upper_bound(n);
+	if (It == Anchors.begin())
+		return -1;
+	--It;
+	if (It->first < Frames.FindClosestVideoKeyFrame(n))
+		return -1;
+	return It->first;
+}
+
+FFMS_Frame *FFMS_VideoSource::OutputAnchor(int n) {
+	// LocalFrame no longer comes from DecodeFrame
+	LastFrameNum = -1;
+	return OutputFrame(Anchors[n]->Frame);
+}
+
+void FFMS_VideoSource::ClearAnchors() {
+	for (std::map<int, DecodedPicture *>::iterator It = Anchors.begin(); It != Anchors.end(); ++It)
+		delete It->second;
+	Anchors.clear();
+	AnchorSize = 0;
+}
+
+DecodedPicture::DecodedPicture(const AVFrame *Src, PixelFormat Format, int Width, int Height)
+: Format(Format)
+, Width(Width)
+, Height(Height)
+, Size(avpicture_get_size(Format, Width, Height))
+{
+	Frame = avcodec_alloc_frame();
+	if (!Frame || PoolPictureAlloc(&Picture, Format, Width, Height) < 0) {
+		av_freep(&Frame);
+		throw FFMS_Exception(FFMS_ERROR_DECODING, FFMS_ERROR_ALLOCATION_FAILED,
+			"Could not allocate a copy of the decoded picture");
+	}
+
+	AVPicture SrcPicture;
+	for (int i = 0; i < 4; i++) {
+		SrcPicture.data[i] = Src->data[i];
+		SrcPicture.linesize[i] = Src->linesize[i];
+	}
+	av_picture_copy(&Picture, &SrcPicture, Format, Width, Height);
+
+	for (int i = 0; i < 4; i++) {
+		Frame->data[i] = Picture.data[i];
+		Frame->linesize[i] = Picture.linesize[i];
+	}
+	Frame->key_frame = Src->key_frame;
+	Frame->pict_type = Src->pict_type;
+	Frame->repeat_pict = Src->repeat_pict;
+	Frame->interlaced_frame = Src->interlaced_frame;
+	Frame->top_field_first = Src->top_field_first;
+}
+
+DecodedPicture::~DecodedPicture() {
+	PoolPictureFree(&Picture);
+	av_freep(&Frame);
+}
+
+PacketCache::PacketCache()
+: Size(0)
+, MaxSize(0)
+, Active(false)
+{
+}
+
+PacketCache::~PacketCache() {
+	Clear();
+}
+
+void PacketCache::Remove(std::map<int, Entry>::iterator It) {
+	Size -= It->second.Packet.size;
+	av_free_packet(&It->second.Packet);
+	Uses.erase(It->second.Use);
+	Packets.erase(It);
+}
+
+const AVPacket *PacketCache::Get(int n) {
+	std::map<int, Entry>::iterator It = Packets.find(n);
+	if (It == Packets.end())
+		return NULL;
+	Uses.splice(Uses.begin(), Uses, It->second.Use);
+	return &It->second.Packet;
+}
+
+void PacketCache::SetMaxSize(int64_t NewMaxSize) {
+	MaxSize = NewMaxSize;
+	while (Size > MaxSize)
+		Remove(Packets.find(Uses.back()));
+}
+
+void PacketCache::Put(int n, const AVPacket &Packet) {
+	if (!Active || Packet.size <= 0 || Packet.size > MaxSize / 4 || Has(n))
+		return;
+
+	while (Size + Packet.size > MaxSize)
+		Remove(Packets.find(Uses.back()));
+
+	Entry &E = Packets[n];
+	if (av_new_packet(&E.Packet, Packet.size) < 0) {
+		Packets.erase(n);
+		return;
+	}
+	memcpy(E.Packet.data, Packet.data, Packet.size);
+	E.Packet.pts = Packet.pts;
+	E.Packet.dts = Packet.dts;
+	E.Packet.pos = Packet.pos;
+	E.Packet.flags = Packet.flags;
+	E.Packet.stream_index = Packet.stream_index;
+	E.Use = Uses.insert(Uses.begin(), n);
+	Size += Packet.size;
+}
+
+void PacketCache::Clear() {
+	while (!Packets.empty())
+		Remove(Packets.begin());
+}
@@ -0,0 +1,259 @@
+//  Copyright (c) 2012 Fredrik Mellbin
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#include "videosource.h"
+#include "bufferpool.h"
+
+extern "C" {
+#include <libavutil/imgutils.h>
+}
+
+#define MAX_PIPELINE_QUEUE 4
+
+FramePipeline::FramePipeline(FFMS_VideoSource *Decoder)
+: Decoder(Decoder)
+, Applied(Decoder->GetOutputSettings())
+, Scalers(SCALER_CACHE_SIZE)
+, Outstanding(0)
+, Generation(0)
+, Quit(false)
+, Error(NULL)
+{
+	Decoder->DeferScaling = true;
+	DecodeThread.reset(new FFThread(DecodeMain, this));
+	ConvertThread.reset(new FFThread(ConvertMain, this));
+}
+
+FramePipeline::~FramePipeline() {
+	Lock.Lock();
+	Quit = true;
+	Drop();
+	Lock.Unlock();
+	DecodeThread.reset();
+	ConvertThread.reset();
+
+	// The decoder may have queued one more picture before it noticed
+	Drop();
+	delete Error;
+}
+
+void FramePipeline::DecodeMain(void *Pipeline) {
+	static_cast<FramePipeline *>(Pipeline)->Decode();
+}
+
+void FramePipeline::ConvertMain(void *Pipeline) {
+	static_cast<FramePipeline *>(Pipeline)->Convert();
+}
+
+void FramePipeline::Decode() {
+	FFScopedLock L(Lock);
+	for (;;) {
+		while (!Quit && (Pending.empty() || Queue.size() >= MAX_PIPELINE_QUEUE))
+			Changed.Wait(Lock);
+		if (Quit)
+			return;
+
+		Decoded Result;
+		Result.Req = Pending.front();
+		memset(&Result.Picture, 0, sizeof(Result.Picture));
+		Result.Scale = false;
+		Pending.pop_front();
+		Lock.Unlock();
+
+		bool Failed = false;
+		FFMS_Exception Failure(FFMS_ERROR_SUCCESS, FFMS_ERROR_SUCCESS);
+		try {
+			if (!(Result.Req.Settings == Applied)) {
+				Decoder->ApplyOutputSettings(Result.Req.Settings);
+				Applied = Result.Req.Settings;
+			}
+
+			// Postprocessed and cropped but not scaled yet, and copied since the
+			// decoder overwrites it with the next frame
+			Result.Frame = *Decoder->GetFrame(Result.Req.n);
+			PixelFormat Format = static_cast<PixelFormat>(Result.Frame.EncodedPixelFormat);
+			if (PoolPictureAlloc(&Result.Picture, Format, Result.Frame.EncodedWidth, Result.Frame.EncodedHeight) < 0)
+				throw FFMS_Exception(FFMS_ERROR_DECODING, FFMS_ERROR_ALLOCATION_FAILED,
+					"Could not allocate a copy of the decoded picture");
+			av_image_copy(Result.Picture.data, Result.Picture.linesize, const_cast<const uint8_t **>(Result.Frame.Data), Result.Frame.Linesize,
+				Format, Result.Frame.EncodedWidth, Result.Frame.EncodedHeight);
+
+			if (Decoder->CurrentScaler) {
+				Result.Scale = true;
+				Result.Scaling = Decoder->CurrentScaler->Settings;
+			}
+		} catch (FFMS_Exception &e) {
+			Failed = true;
+			Failure = e;
+		}
+
+		Lock.Lock();
+		if (Failed || Result.Req.Generation != Generation) {
+			if (Failed && Result.Req.Generation == Generation)
+				Fail(Failure);
+			PoolPictureFree(&Result.Picture);
+			Outstanding--;
+		} else {
+			Queue.push_back(Result);
+		}
+		Changed.Broadcast();
+	}
+}
+
+void FramePipeline::Convert() {
+	FFScopedLock L(Lock);
+	for (;;) {
+		while (!Quit && Queue.empty())
+			Changed.Wait(Lock);
+		if (Quit)
+			return;
+
+		Decoded Item = Queue.front();
+		Queue.pop_front();
+		Changed.Broadcast();
+		Lock.Unlock();
+
+		bool Failed = false;
+		FFMS_Exception Failure(FFMS_ERROR_SUCCESS, FFMS_ERROR_SUCCESS);
+		try {
+			AVPicture *Output = &Item.Picture;
+			if (Item.Scale) {
+				ScalerCache::Scaler *Scaler = Scalers.Get(Item.Scaling, 1);
+				if (!Scaler)
+					throw FFMS_Exception(FFMS_ERROR_SCALING, FFMS_ERROR_INVALID_ARGUMENT,
+						"Failed to allocate SWScale context");
+
+				if (Scaler->Convert)
+					Scaler->Convert(Item.Picture.data, Item.Picture.linesize, Scaler->Frame.data, Scaler->Frame.linesize, Item.Scaling.SrcW, Item.Scaling.SrcH);
+				else
+					sws_scale(Scaler->Context, Item.Picture.data, Item.Picture.linesize, 0, Item.Scaling.SrcH, Scaler->Frame.data, Scaler->Frame.linesize);
+				Output = &Scaler->Frame;
+			}
+
+			for (int i = 0; i < 4; i++) {
+				Item.Frame.Data[i] = Output->data[i];
+				Item.Frame.Linesize[i] = Output->linesize[i];
+			}
+
+			if ((*Item.Req.Callback)(Item.Req.n, Item.Req.Position, &Item.Frame, Item.Req.Private))
+				throw FFMS_Exception(FFMS_ERROR_CANCELLED, FFMS_ERROR_USER,
+					"Cancelled by user");
+		} catch (FFMS_Exception &e) {
+			Failed = true;
+			Failure = e;
+		}
+		PoolPictureFree(&Item.Picture);
+
+		Lock.Lock();
+		if (Failed && Item.Req.Generation == Generation)
+			Fail(Failure);
+		Outstanding--;
+		Changed.Broadcast();
+	}
+}
+
+void FramePipeline::Drop() {
+	for (size_t i = 0; i < Queue.size(); i++)
+		PoolPictureFree(&Queue[i].Picture);
+	Outstanding -= static_cast<int>(Pending.size() + Queue.size());
+	Pending.clear();
+	Queue.clear();
+	Generation++;
+	Changed.Broadcast();
+}
+
+void FramePipeline::Fail(const FFMS_Exception &e) {
+	if (!Error)
+		Error = new FFMS_Exception(e);
+	Drop();
+}
+
+void FramePipeline::Submit(const std::vector<std::pair<int, int> > &Frames, TFrameCallback Callback, void *Private, const OutputSettings &Settings) {
+	FFScopedLock L(Lock);
+	for (size_t i = 0; i < Frames.size(); i++) {
+		Request Req = { Frames[i].first, Frames[i].second, Callback, Private, Settings, Generation };
+		Pending.push_back(Req);
+	}
+	Outstanding += static_cast<int>(Frames.size());
+	Changed.Broadcast();
+}
+
+void FramePipeline::Wait() {
+	// The frame being delivered is outstanding until the callback returns
+	if (ConvertThread->IsCurrent())
+		throw FFMS_Exception(FFMS_ERROR_DECODING, FFMS_ERROR_INVALID_ARGUMENT,
+			"Can't wait for the frames from within the frame callback");
+
+	FFScopedLock L(Lock);
+	while (Outstanding > 0)
+		Changed.Wait(Lock);
+
+	if (Error) {
+		FFMS_Exception e(*Error);
+		delete Error;
+		Error = NULL;
+		throw e;
+	}
+}
+
+void FramePipeline::Cancel() {
+	FFScopedLock L(Lock);
+	Drop();
+	// Nothing else is delivered once the callback calling this returns
+	if (ConvertThread->IsCurrent())
+		return;
+	while (Outstanding > 0)
+		Changed.Wait(Lock);
+	delete Error;
+	Error = NULL;
+}
+
+void FFMS_VideoSource::GetFramesAsync(const int *FrameNumbers, int NumFrames, TFrameCallback FC, void *Private) {
+	std::vector<std::pair<int, int> > Requests;
+	Requests.reserve(NumFrames);
+	for (int i = 0; i < NumFrames; i++) {
+		GetFrameCheck(FrameNumbers[i]);
+		Requests.push_back(std::make_pair(FrameNumbers[i], i));
+	}
+
+	if (!Pipeline.get()) {
+		FFMS_VideoSource *Decoder = Duplicate();
+		// Sources that can't be duplicated deliver everything right away
+		if (!Decoder) {
+			GetFrames(FrameNumbers, NumFrames, FC, Private);
+			return;
+		}
+		Pipeline.reset(new FramePipeline(Decoder));
+	}
+
+	// Same order as GetFrames for the same reasons
+	std::sort(Requests.begin(), Requests.end());
+	Pipeline->Submit(Requests, FC, Private, GetOutputSettings());
+}
+
+void FFMS_VideoSource::WaitAsync() {
+	if (Pipeline.get())
+		Pipeline->Wait();
+}
+
+void FFMS_VideoSource::CancelAsync() {
+	if (Pipeline.get())
+		Pipeline->Cancel();
+}
@@ -0,0 +1,122 @@
+//  Copyright (c) 2012 Fredrik Mellbin
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#include "videosource.h"
+#include "bufferpool.h"
+
+// Protects the reference counts and FrameRefs of all sources, since
+// frames may be released from any thread and after their source is gone
+static FFMutex FrameRefLock;
+// Every frame from GetFrameRef that hasn't been freed yet, whether or not
+// its source still exists, so that other pointers can be told apart
+static std::set<const FFMS_Frame *> LiveFrameRefs;
+
+// FrameRefLock must be held
+static FrameRef *FindFrameRef(const FFMS_Frame *Frame) {
+	if (!LiveFrameRefs.count(Frame))
+		throw FFMS_Exception(FFMS_ERROR_DECODING, FFMS_ERROR_INVALID_ARGUMENT,
+			"The frame wasn't returned by FFMS_GetFrameRef or has already been freed");
+	return reinterpret_cast<FrameRef *>(const_cast<FFMS_Frame *>(Frame));
+}
+
+// Frames that are still held outlive the source
+void FFMS_VideoSource::DetachFrameRefs() {
+	FFScopedLock L(FrameRefLock);
+	for (std::set<FrameRef *>::iterator It = FrameRefs.begin(); It != FrameRefs.end(); ++It)
+		(*It)->Source = NULL;
+}
+
+FrameRef::FrameRef()
+: RefCount(1)
+, Source(NULL)
+{
+	memset(&Frame, 0, sizeof(Frame));
+	memset(&Picture, 0, sizeof(Picture));
+}
+
+FrameRef::~FrameRef() {
+	PoolPictureFree(&Picture);
+}
+
+FFMS_Frame *FFMS_VideoSource::GetFrameRef(int n) {
+	GetFrameCheck(n);
+
+	{
+		FFScopedLock L(FrameRefLock);
+		if (FrameRefLimit > 0 && static_cast<int>(FrameRefs.size()) >= FrameRefLimit)
+			throw FFMS_Exception(FFMS_ERROR_DECODING, FFMS_ERROR_USER,
+				"Too many frames are held, release some of them first");
+	}
+
+	std::auto_ptr<FrameRef> Ref(new FrameRef);
+	PixelFormat Format;
+	int Width, Height;
+	GetOutputSize(Format, Width, Height);
+
+	// The frame is decoded straight into the new picture unless it turns
+	// out to have a different size than expected, in which case it's
+	// output again into a picture of the right size
+	for (;;) {
+		PoolPictureFree(&Ref->Picture);
+		if (PoolPictureAlloc(&Ref->Picture, Format, Width, Height) < 0)
+			throw FFMS_Exception(FFMS_ERROR_DECODING, FFMS_ERROR_ALLOCATION_FAILED,
+				"Could not allocate a frame buffer");
+
+		GetFrameDirect(n, Ref->Picture.data, Ref->Picture.linesize, Format, Width, Height);
+		if (LocalFrameDirect)
+			break;
+		GetOutputSize(Format, Width, Height);
+	}
+
+	Ref->Frame = LocalFrame;
+	Ref->Source = this;
+
+	FFScopedLock L(FrameRefLock);
+	FrameRefs.insert(Ref.get());
+	LiveFrameRefs.insert(&Ref->Frame);
+	return &Ref.release()->Frame;
+}
+
+void FFMS_VideoSource::SetFrameRefLimit(int MaxFrames) {
+	FFScopedLock L(FrameRefLock);
+	FrameRefLimit = MaxFrames;
+}
+
+void FFMS_VideoSource::AddFrameRef(const FFMS_Frame *Frame) {
+	FFScopedLock L(FrameRefLock);
+	FindFrameRef(Frame)->RefCount++;
+}
+
+void FFMS_VideoSource::ReleaseFrameRef(const FFMS_Frame *Frame) {
+	if (!Frame)
+		return;
+
+	FrameRef *Ref;
+	{
+		FFScopedLock L(FrameRefLock);
+		Ref = FindFrameRef(Frame);
+		if (--Ref->RefCount > 0)
+			return;
+		if (Ref->Source)
+			Ref->Source->FrameRefs.erase(Ref);
+		LiveFrameRefs.erase(Frame);
+	}
+	delete Ref;
+}
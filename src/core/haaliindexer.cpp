@@ -95,6 +95,8 @@ FFMS_Index *FFHaaliIndexer::DoIndexing() {
 
 			if (CodecContext->codec->id == CODEC_ID_H264 && SourceMode == FFMS_SOURCE_HAALIMPEG)
 				VideoContexts[i].BitStreamFilter = av_bitstream_filter_init("h264_mp4toannexb");
+
+			(*TrackIndices)[i].HasReferenceInfo = HasReferenceInfo(VideoContexts[i]);
 		}
 		else {
 			AudioContexts[i].CodecContext = CodecContext;
@@ -152,9 +154,10 @@ FFMS_Index *FFHaaliIndexer::DoIndexing() {
 
 			int RepeatPict = -1;
 			int FrameType = 0;
-			ParseVideoPacket(VideoContexts[Track], TempPacket, &RepeatPict, &FrameType);
+			bool Reference = true;
+			ParseVideoPacket(VideoContexts[Track], TempPacket, &RepeatPict, &FrameType, &Reference);
 
-			(*TrackIndices)[Track].push_back(TFrameInfo::VideoFrameInfo(Ts, RepeatPict, pMMF->IsSyncPoint() == S_OK, FrameType));
+			(*TrackIndices)[Track].push_back(TFrameInfo::VideoFrameInfo(Ts, RepeatPict, pMMF->IsSyncPoint() == S_OK, FrameType, Reference));
 
 			av_free(TempPacket.data);
 		} else if (TrackType[Track] == FFMS_TYPE_AUDIO && (IndexMask & (1 << Track))) {
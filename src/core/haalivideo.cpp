@@ -32,11 +32,17 @@ void FFHaaliVideo::Free(bool CloseCodec) {
 }
 
 FFHaaliVideo::FFHaaliVideo(const char *SourceFile, int Track,
-	FFMS_Index &Index, int Threads, FFMS_Sources SourceMode)
-: Res(FFSourceResources<FFMS_VideoSource>(this)), FFMS_VideoSource(SourceFile, Index, Track, Threads) {
+	FFMS_Index &Index, int Threads, FFMS_Sources SourceMode, int Flags)
+: Res(FFSourceResources<FFMS_VideoSource>(this)), FFMS_VideoSource(SourceFile, Index, Track, Threads, Flags)
+, SourceFile(SourceFile), SourceMode(SourceMode) {
 	BitStreamFilter = NULL;
 
-	pMMC = HaaliOpenFile(SourceFile, SourceMode);
+	if (!(Flags & FFMS_VSF_LAZY))
+		Open();
+}
+
+void FFHaaliVideo::OpenDecoder() {
+	pMMC = HaaliOpenFile(SourceFile.c_str(), SourceMode);
 
 	CComPtr<IEnumUnknown> pEU;
 	if (!SUCCEEDED(pMMC->EnumTracks(&pEU)))
@@ -45,10 +51,10 @@ FFHaaliVideo::FFHaaliVideo(const char *SourceFile, int Track,
 
 	CComPtr<IUnknown> pU;
 	int CurrentTrack = -1;
-	while (pEU->Next(1, &pU, NULL) == S_OK && ++CurrentTrack != Track) pU = NULL;
+	while (pEU->Next(1, &pU, NULL) == S_OK && ++CurrentTrack != VideoTrack) pU = NULL;
 	CComQIPtr<IPropertyBag> pBag = pU;
 
-	if (CurrentTrack != Track || !pBag)
+	if (CurrentTrack != VideoTrack || !pBag)
 		throw FFMS_Exception(FFMS_ERROR_DECODING, FFMS_ERROR_CODEC,
 			"Failed to find track");
 
@@ -57,6 +63,7 @@ FFHaaliVideo::FFHaaliVideo(const char *SourceFile, int Track,
 
 	AVCodec *Codec = NULL;
 	std::swap(Codec, CodecContext->codec);
+	SetDecoderOptions(CodecContext, Codec);
 	if (avcodec_open2(CodecContext, Codec, NULL) < 0)
 		throw FFMS_Exception(FFMS_ERROR_DECODING, FFMS_ERROR_CODEC,
 			"Could not open video codec");
@@ -126,9 +133,18 @@ void FFHaaliVideo::DecodeNextFrame(int64_t *AFirstStartTime) {
 
 		if (pMMF->GetTrack() == VideoTrack) {
 			REFERENCE_TIME  Ts, Te;
-			if (*AFirstStartTime < 0 && SUCCEEDED(pMMF->GetTime(&Ts, &Te)))
+			bool HasTime = SUCCEEDED(pMMF->GetTime(&Ts, &Te));
+			if (*AFirstStartTime < 0 && HasTime)
 				*AFirstStartTime = Ts;
 
+			// Frames nothing depends on don't have to be copied and decoded
+			if (HasTime && CanDropPacket(Frames.FrameFromPTS(Ts))) {
+				DelayCounter++;
+				if (DelayCounter > FFMS_CALCULATE_DELAY && !InitialDecode)
+					goto Done;
+				continue;
+			}
+
 			BYTE *Data = NULL;
 			if (FAILED(pMMF->GetPointer(&Data)))
 				goto Error;
@@ -176,12 +192,18 @@ void FFHaaliVideo::DecodeNextFrame(int64_t *AFirstStartTime) {
 
 Error:
 Done:
+	if (FrameFinished)
+		DecodedPictures++;
 	if (InitialDecode == 1) InitialDecode = -1;
 }
 
 FFMS_Frame *FFHaaliVideo::GetFrame(int n) {
 	GetFrameCheck(n);
 
+	FFMS_Frame *Buffered = GetCachedFrame(n);
+	if (Buffered)
+		return Buffered;
+
 	if (LastFrameNum == n)
 		return &LocalFrame;
 
@@ -199,10 +221,7 @@ ReSeek:
 
 	do {
 		int64_t StartTime = -1;
-		if (CurrentFrame + FFMS_CALCULATE_DELAY >= n)
-			CodecContext->skip_frame = AVDISCARD_DEFAULT;
-		else
-			CodecContext->skip_frame = AVDISCARD_NONREF;
+		SetSkipFrame(n);
 		DecodeNextFrame(&StartTime);
 
 		if (HasSeeked) {
@@ -219,11 +238,13 @@ ReSeek:
 			}
 		}
 
+		StoreAnchor(CurrentFrame);
+		StoreReversePicture();
 		CurrentFrame++;
 	} while (CurrentFrame <= n);
 
 	LastFrameNum = n;
-	return OutputFrame(DecodeFrame);
+	return OutputDecodeFrame();
 }
 
 #endif // HAALISOURCE
@@ -90,6 +90,36 @@ struct TrackHeader {
 	int64_t Den;
 	uint32_t UseDTS;
 	uint32_t HasTS;
+	uint32_t HasReferenceInfo;
+};
+
+struct CodecParamsHeader {
+	uint32_t Valid;
+	int32_t Codec;
+	uint32_t CodecTag;
+	int32_t Width;
+	int32_t Height;
+	int32_t PixFmt;
+	int32_t SampleFmt;
+	int32_t SampleRate;
+	int32_t Channels;
+	int32_t BitsPerCodedSample;
+	int32_t BlockAlign;
+	int32_t HasBFrames;
+	int32_t SARNum;
+	int32_t SARDen;
+	int32_t CodecTBNum;
+	int32_t CodecTBDen;
+	int32_t StreamTBNum;
+	int32_t StreamTBDen;
+	int32_t RFrameRateNum;
+	int32_t RFrameRateDen;
+	int32_t AvgFrameRateNum;
+	int32_t AvgFrameRateDen;
+	uint32_t ExtradataSize;
+	int64_t ChannelLayout;
+	int64_t StartTime;
+	int64_t Duration;
 };
 
 
@@ -131,25 +161,26 @@ SharedAudioContext::~SharedAudioContext() {
 	delete TCC;
 }
 
-TFrameInfo::TFrameInfo(int64_t PTS, int64_t SampleStart, unsigned int SampleCount, int RepeatPict, bool KeyFrame, int64_t FilePos, unsigned int FrameSize, int FrameType)
+TFrameInfo::TFrameInfo(int64_t PTS, int64_t SampleStart, unsigned int SampleCount, int RepeatPict, bool KeyFrame, int64_t FilePos, unsigned int FrameSize, int FrameType, bool Reference)
 : SampleStart(SampleStart)
 , SampleCount(SampleCount)
 , FilePos(FilePos)
 , FrameSize(FrameSize)
 , OriginalPos(0)
 , FrameType(FrameType)
+, Reference(Reference)
 {
 	this->PTS = PTS;
 	this->RepeatPict = RepeatPict;
 	this->KeyFrame = KeyFrame;
 }
 
-TFrameInfo TFrameInfo::VideoFrameInfo(int64_t PTS, int RepeatPict, bool KeyFrame, int FrameType, int64_t FilePos, unsigned int FrameSize) {
-	return TFrameInfo(PTS, 0, 0, RepeatPict, KeyFrame, FilePos, FrameSize, FrameType);
+TFrameInfo TFrameInfo::VideoFrameInfo(int64_t PTS, int RepeatPict, bool KeyFrame, int FrameType, bool Reference, int64_t FilePos, unsigned int FrameSize) {
+	return TFrameInfo(PTS, 0, 0, RepeatPict, KeyFrame, FilePos, FrameSize, FrameType, Reference);
 }
 
 TFrameInfo TFrameInfo::AudioFrameInfo(int64_t PTS, int64_t SampleStart, int64_t SampleCount, bool KeyFrame, int64_t FilePos, unsigned int FrameSize) {
-	return TFrameInfo(PTS, SampleStart, static_cast<unsigned int>(SampleCount), 0, KeyFrame, FilePos, FrameSize, 0);
+	return TFrameInfo(PTS, SampleStart, static_cast<unsigned int>(SampleCount), 0, KeyFrame, FilePos, FrameSize, 0, true);
 }
 
 void FFMS_Track::WriteTimecodes(const char *TimecodeFile) {
@@ -165,11 +196,18 @@ void FFMS_Track::WriteTimecodes(const char *TimecodeFile) {
 		Timecodes << std::fixed << ((Cur->PTS * TB.Num) / (double)TB.Den) << "\n";
 }
 
+static bool PTSComparison(const TFrameInfo &FI1, const TFrameInfo &FI2) {
+	return FI1.PTS < FI2.PTS;
+}
+
 int FFMS_Track::FrameFromPTS(int64_t PTS) {
-	for (int i = 0; i < static_cast<int>(size()); i++)
-		if (at(i).PTS == PTS)
-			return i;
-	return -1;
+	TFrameInfo F;
+	F.PTS = PTS;
+
+	iterator Pos = std::lower_bound(begin(), end(), F, PTSComparison);
+	if (Pos == end() || Pos->PTS != PTS)
+		return -1;
+	return std::distance(begin(), Pos);
 }
 
 int FFMS_Track::FrameFromPos(int64_t Pos) {
@@ -179,10 +217,6 @@ int FFMS_Track::FrameFromPos(int64_t Pos) {
 	return -1;
 }
 
-static bool PTSComparison(TFrameInfo FI1, TFrameInfo FI2) {
-	return FI1.PTS < FI2.PTS;
-}
-
 int FFMS_Track::ClosestFrameFromPTS(int64_t PTS) {
 	TFrameInfo F;
 	F.PTS = PTS;
@@ -196,6 +230,11 @@ int FFMS_Track::ClosestFrameFromPTS(int64_t PTS) {
 	return Frame - 1;
 }
 
+// Time is in seconds, like in FFMS_GetFrameByTime
+int FFMS_Track::ClosestFrameFromTime(double Time) {
+	return ClosestFrameFromPTS(static_cast<int64_t>((Time * 1000 * TB.Den) / TB.Num));
+}
+
 int FFMS_Track::FindClosestVideoKeyFrame(int Frame) {
 	Frame = FFMIN(FFMAX(Frame, 0), static_cast<int>(size()) - 1);
 	for (; Frame > 0 && !at(Frame).KeyFrame; Frame--) ;
@@ -203,6 +242,17 @@ int FFMS_Track::FindClosestVideoKeyFrame(int Frame) {
 	return Frame;
 }
 
+int FFMS_Track::FindNearestKeyFrame(int Frame) {
+	Frame = FFMIN(FFMAX(Frame, 0), static_cast<int>(size()) - 1);
+	int Prev = Frame;
+	for (; Prev > 0 && !at(Prev).KeyFrame; Prev--) ;
+	int Next = Frame;
+	for (; Next < static_cast<int>(size()) && !at(Next).KeyFrame; Next++) ;
+	if (Next < static_cast<int>(size()) && Next - Frame < Frame - Prev)
+		return Next;
+	return Prev;
+}
+
 void FFMS_Track::MaybeReorderFrames() {
 	// First check if we need to do anything
 	bool has_b_frames = false;
@@ -235,12 +285,100 @@ void FFMS_Track::MaybeReorderFrames() {
 	}
 }
 
+TCodecParams::TCodecParams() {
+	Valid = false;
+	Codec = CODEC_ID_NONE;
+	CodecTag = 0;
+	Width = 0;
+	Height = 0;
+	PixFmt = PIX_FMT_NONE;
+	SampleFmt = AV_SAMPLE_FMT_NONE;
+	SampleRate = 0;
+	Channels = 0;
+	ChannelLayout = 0;
+	BitsPerCodedSample = 0;
+	BlockAlign = 0;
+	HasBFrames = 0;
+	SampleAspectRatio.num = 0;
+	SampleAspectRatio.den = 1;
+	CodecTimeBase.num = 0;
+	CodecTimeBase.den = 1;
+	StreamTimeBase.num = 0;
+	StreamTimeBase.den = 1;
+	RFrameRate.num = 0;
+	RFrameRate.den = 1;
+	AvgFrameRate.num = 0;
+	AvgFrameRate.den = 1;
+	StartTime = ffms_av_nopts_value;
+	Duration = ffms_av_nopts_value;
+}
+
+void TCodecParams::Store(const AVStream *Stream) {
+	const AVCodecContext *Context = Stream->codec;
+	Valid = true;
+	Codec = Context->codec_id;
+	CodecTag = Context->codec_tag;
+	Width = Context->width;
+	Height = Context->height;
+	PixFmt = Context->pix_fmt;
+	SampleFmt = Context->sample_fmt;
+	SampleRate = Context->sample_rate;
+	Channels = Context->channels;
+	ChannelLayout = Context->channel_layout;
+	BitsPerCodedSample = Context->bits_per_coded_sample;
+	BlockAlign = Context->block_align;
+	HasBFrames = Context->has_b_frames;
+	SampleAspectRatio = Context->sample_aspect_ratio;
+	CodecTimeBase = Context->time_base;
+	StreamTimeBase = Stream->time_base;
+	RFrameRate = Stream->r_frame_rate;
+	AvgFrameRate = Stream->avg_frame_rate;
+	StartTime = Stream->start_time;
+	Duration = Stream->duration;
+	Extradata.assign(Context->extradata, Context->extradata + Context->extradata_size);
+}
+
+void TCodecParams::Apply(AVStream *Stream) const {
+	AVCodecContext *Context = Stream->codec;
+	Context->codec_id = static_cast<CodecID>(Codec);
+	Context->codec_tag = CodecTag;
+	Context->width = Width;
+	Context->height = Height;
+	Context->pix_fmt = static_cast<PixelFormat>(PixFmt);
+	Context->sample_fmt = static_cast<AVSampleFormat>(SampleFmt);
+	Context->sample_rate = SampleRate;
+	Context->channels = Channels;
+	Context->channel_layout = ChannelLayout;
+	Context->bits_per_coded_sample = BitsPerCodedSample;
+	Context->block_align = BlockAlign;
+	// The decoder's reordering delay, which FFMS_CALCULATE_DELAY depends on
+	Context->has_b_frames = HasBFrames;
+	Context->sample_aspect_ratio = SampleAspectRatio;
+	Context->time_base = CodecTimeBase;
+	Stream->time_base = StreamTimeBase;
+	Stream->r_frame_rate = RFrameRate;
+	Stream->avg_frame_rate = AvgFrameRate;
+	Stream->start_time = StartTime;
+	Stream->duration = Duration;
+
+	// Probing can only have added to what the header had, so an empty one is kept
+	if (!Extradata.empty()) {
+		av_freep(&Context->extradata);
+		Context->extradata = static_cast<uint8_t *>(av_mallocz(Extradata.size() + FF_INPUT_BUFFER_PADDING_SIZE));
+		if (!Context->extradata)
+			throw FFMS_Exception(FFMS_ERROR_PARSER, FFMS_ERROR_ALLOCATION_FAILED, "Out of memory");
+		memcpy(Context->extradata, &Extradata[0], Extradata.size());
+		Context->extradata_size = Extradata.size();
+	}
+}
+
 FFMS_Track::FFMS_Track() {
 	this->TT = FFMS_TYPE_UNKNOWN;
 	this->TB.Num = 0;
 	this->TB.Den = 0;
 	this->UseDTS = false;
 	this->HasTS = true;
+	this->HasReferenceInfo = false;
 }
 
 FFMS_Track::FFMS_Track(int64_t Num, int64_t Den, FFMS_TrackType TT, bool UseDTS, bool HasTS) {
@@ -249,6 +387,7 @@ FFMS_Track::FFMS_Track(int64_t Num, int64_t Den, FFMS_TrackType TT, bool UseDTS,
 	this->TB.Den = Den;
 	this->UseDTS = UseDTS;
 	this->HasTS = HasTS;
+	this->HasReferenceInfo = false;
 }
 
 void FFMS_Index::CalculateFileSignature(const char *Filename, int64_t *Filesize, uint8_t Digest[20]) {
@@ -406,6 +545,7 @@ void FFMS_Index::WriteIndex(const char *IndexFile) {
 		TH.Den = ctrack.TB.Den;
 		TH.UseDTS = ctrack.UseDTS;
 		TH.HasTS = ctrack.HasTS;
+		TH.HasReferenceInfo = ctrack.HasReferenceInfo;
 
 		FFMS_Track temptrack;
 		temptrack.resize(TH.Frames);
@@ -424,6 +564,40 @@ void FFMS_Index::WriteIndex(const char *IndexFile) {
 		z_def(&IndexStream, &stream, &TH, sizeof(TrackHeader), 0);
 		if (TH.Frames)
 			z_def(&IndexStream, &stream, FFMS_GET_VECTOR_PTR(temptrack), TH.Frames * sizeof(TFrameInfo), 0);
+
+		const TCodecParams &CP = ctrack.CodecParams;
+		CodecParamsHeader CH;
+		memset(&CH, 0, sizeof(CH));
+		CH.Valid = CP.Valid;
+		CH.Codec = CP.Codec;
+		CH.CodecTag = CP.CodecTag;
+		CH.Width = CP.Width;
+		CH.Height = CP.Height;
+		CH.PixFmt = CP.PixFmt;
+		CH.SampleFmt = CP.SampleFmt;
+		CH.SampleRate = CP.SampleRate;
+		CH.Channels = CP.Channels;
+		CH.BitsPerCodedSample = CP.BitsPerCodedSample;
+		CH.BlockAlign = CP.BlockAlign;
+		CH.HasBFrames = CP.HasBFrames;
+		CH.SARNum = CP.SampleAspectRatio.num;
+		CH.SARDen = CP.SampleAspectRatio.den;
+		CH.CodecTBNum = CP.CodecTimeBase.num;
+		CH.CodecTBDen = CP.CodecTimeBase.den;
+		CH.StreamTBNum = CP.StreamTimeBase.num;
+		CH.StreamTBDen = CP.StreamTimeBase.den;
+		CH.RFrameRateNum = CP.RFrameRate.num;
+		CH.RFrameRateDen = CP.RFrameRate.den;
+		CH.AvgFrameRateNum = CP.AvgFrameRate.num;
+		CH.AvgFrameRateDen = CP.AvgFrameRate.den;
+		CH.ExtradataSize = CP.Extradata.size();
+		CH.ChannelLayout = CP.ChannelLayout;
+		CH.StartTime = CP.StartTime;
+		CH.Duration = CP.Duration;
+
+		z_def(&IndexStream, &stream, &CH, sizeof(CodecParamsHeader), 0);
+		if (CH.ExtradataSize)
+			z_def(&IndexStream, &stream, const_cast<uint8_t *>(&CP.Extradata[0]), CH.ExtradataSize, 0);
 	}
 	z_def(&IndexStream, &stream, NULL, 0, 1);
 }
@@ -508,12 +682,46 @@ void FFMS_Index::ReadIndex(const char *IndexFile) {
 			z_inf(&Index, &stream, &in, CHUNK, &TH, sizeof(TrackHeader));
 			push_back(FFMS_Track(TH.Num, TH.Den, static_cast<FFMS_TrackType>(TH.TT), TH.UseDTS != 0, TH.HasTS != 0));
 			FFMS_Track &ctrack = at(i);
+			ctrack.HasReferenceInfo = TH.HasReferenceInfo != 0;
 
 			if (TH.Frames) {
 				ctrack.resize(TH.Frames);
 				z_inf(&Index, &stream, &in, CHUNK, FFMS_GET_VECTOR_PTR(ctrack), TH.Frames * sizeof(TFrameInfo));
 			}
 
+			CodecParamsHeader CH;
+			z_inf(&Index, &stream, &in, CHUNK, &CH, sizeof(CodecParamsHeader));
+			TCodecParams &CP = ctrack.CodecParams;
+			CP.Valid = CH.Valid != 0;
+			CP.Codec = CH.Codec;
+			CP.CodecTag = CH.CodecTag;
+			CP.Width = CH.Width;
+			CP.Height = CH.Height;
+			CP.PixFmt = CH.PixFmt;
+			CP.SampleFmt = CH.SampleFmt;
+			CP.SampleRate = CH.SampleRate;
+			CP.Channels = CH.Channels;
+			CP.BitsPerCodedSample = CH.BitsPerCodedSample;
+			CP.BlockAlign = CH.BlockAlign;
+			CP.HasBFrames = CH.HasBFrames;
+			CP.SampleAspectRatio.num = CH.SARNum;
+			CP.SampleAspectRatio.den = CH.SARDen;
+			CP.CodecTimeBase.num = CH.CodecTBNum;
+			CP.CodecTimeBase.den = CH.CodecTBDen;
+			CP.StreamTimeBase.num = CH.StreamTBNum;
+			CP.StreamTimeBase.den = CH.StreamTBDen;
+			CP.RFrameRate.num = CH.RFrameRateNum;
+			CP.RFrameRate.den = CH.RFrameRateDen;
+			CP.AvgFrameRate.num = CH.AvgFrameRateNum;
+			CP.AvgFrameRate.den = CH.AvgFrameRateDen;
+			CP.ChannelLayout = CH.ChannelLayout;
+			CP.StartTime = CH.StartTime;
+			CP.Duration = CH.Duration;
+			if (CH.ExtradataSize) {
+				CP.Extradata.resize(CH.ExtradataSize);
+				z_inf(&Index, &stream, &in, CHUNK, &CP.Extradata[0], CH.ExtradataSize);
+			}
+
 			for (size_t j = 1; j < ctrack.size(); j++) {
 				ctrack[j].FilePos = ctrack[j].FilePos + ctrack[j - 1].FilePos;
 				ctrack[j].OriginalPos = ctrack[j].OriginalPos + ctrack[j - 1].OriginalPos;
@@ -731,7 +939,70 @@ void FFMS_Indexer::CheckAudioProperties(int Track, AVCodecContext *Context) {
 	}
 }
 
-void FFMS_Indexer::ParseVideoPacket(SharedVideoContext &VideoContext, AVPacket &pkt, int *RepeatPict, int *FrameType) {
+// Returns the nal_ref_idc of the NAL unit if it is a coded slice, -1 otherwise
+static int H264SliceRefIdc(const uint8_t *NAL, uint32_t Size) {
+	if (Size < 1)
+		return -1;
+	int Type = NAL[0] & 0x1F;
+	if (Type != 1 && Type != 5)
+		return -1;
+	return (NAL[0] >> 5) & 3;
+}
+
+static bool IsH264Reference(AVCodecContext *CodecContext, const uint8_t *Data, int Size) {
+	// Length prefixed NAL units, only trusted if the lengths add up exactly
+	if (CodecContext->extradata_size >= 5 && CodecContext->extradata[0] == 1) {
+		int LengthSize = (CodecContext->extradata[4] & 3) + 1;
+		const uint8_t *Cur = Data;
+		const uint8_t *End = Data + Size;
+		int RefIdc = -1;
+		while (End - Cur > LengthSize) {
+			uint32_t NALSize = 0;
+			for (int i = 0; i < LengthSize; i++)
+				NALSize = (NALSize << 8) | *Cur++;
+			if (NALSize > static_cast<uint32_t>(End - Cur))
+				break;
+			if (RefIdc < 0)
+				RefIdc = H264SliceRefIdc(Cur, NALSize);
+			Cur += NALSize;
+		}
+		if (Cur == End)
+			return RefIdc != 0;
+	}
+
+	// Annex B start codes
+	for (int i = 0; i + 3 < Size; i++) {
+		if (Data[i] == 0 && Data[i + 1] == 0 && Data[i + 2] == 1) {
+			int RefIdc = H264SliceRefIdc(Data + i + 3, Size - i - 3);
+			if (RefIdc >= 0)
+				return RefIdc != 0;
+			i += 2;
+		}
+	}
+
+	// Nothing found so assume the worst
+	return true;
+}
+
+bool FFMS_Indexer::HasReferenceInfo(SharedVideoContext &VideoContext) {
+	if (!VideoContext.Parser || !VideoContext.CodecContext)
+		return false;
+
+	switch (VideoContext.CodecContext->codec_id) {
+		case CODEC_ID_H264:
+		case CODEC_ID_MPEG1VIDEO:
+		case CODEC_ID_MPEG2VIDEO:
+		case CODEC_ID_MPEG4:
+		case CODEC_ID_VC1:
+			return true;
+		default:
+			return false;
+	}
+}
+
+void FFMS_Indexer::ParseVideoPacket(SharedVideoContext &VideoContext, AVPacket &pkt, int *RepeatPict, int *FrameType, bool *Reference) {
+	*Reference = true;
+
 	if (VideoContext.Parser) {
 		uint8_t *OB;
 		int OBSize;
@@ -743,5 +1014,13 @@ void FFMS_Indexer::ParseVideoPacket(SharedVideoContext &VideoContext, AVPacket &
 
 		*RepeatPict = VideoContext.Parser->repeat_pict;
 		*FrameType = VideoContext.Parser->pict_type;
+
+		if (HasReferenceInfo(VideoContext)) {
+			// B-frames can be references in H.264 so the slice headers have to be checked
+			if (VideoContext.CodecContext->codec_id == CODEC_ID_H264)
+				*Reference = IsH264Reference(VideoContext.CodecContext, pkt.data, pkt.size);
+			else
+				*Reference = *FrameType != AV_PICTURE_TYPE_B && *FrameType != AV_PICTURE_TYPE_BI;
+		}
 	}
 }
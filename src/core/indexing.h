@@ -73,12 +73,44 @@ public:
 	unsigned int FrameSize;
 	size_t OriginalPos;
 	int FrameType;
+	bool Reference;
 
-	TFrameInfo() { }
-	static TFrameInfo VideoFrameInfo(int64_t PTS, int RepeatPict, bool KeyFrame, int FrameType, int64_t FilePos = 0, unsigned int FrameSize = 0);
+	TFrameInfo() : Reference(true) { }
+	static TFrameInfo VideoFrameInfo(int64_t PTS, int RepeatPict, bool KeyFrame, int FrameType, bool Reference, int64_t FilePos = 0, unsigned int FrameSize = 0);
 	static TFrameInfo AudioFrameInfo(int64_t PTS, int64_t SampleStart, int64_t SampleCount, bool KeyFrame, int64_t FilePos = 0, unsigned int FrameSize = 0);
 private:
-	TFrameInfo(int64_t PTS, int64_t SampleStart, unsigned int SampleCount, int RepeatPict, bool KeyFrame, int64_t FilePos, unsigned int FrameSize, int FrameType);
+	TFrameInfo(int64_t PTS, int64_t SampleStart, unsigned int SampleCount, int RepeatPict, bool KeyFrame, int64_t FilePos, unsigned int FrameSize, int FrameType, bool Reference);
+};
+
+// What avformat_find_stream_info found out about a stream while indexing,
+// so the lavf sources can open the file again without probing it
+struct TCodecParams {
+	bool Valid;
+	int Codec;
+	unsigned int CodecTag;
+	int Width;
+	int Height;
+	int PixFmt;
+	int SampleFmt;
+	int SampleRate;
+	int Channels;
+	int64_t ChannelLayout;
+	int BitsPerCodedSample;
+	int BlockAlign;
+	int HasBFrames;
+	AVRational SampleAspectRatio;
+	AVRational CodecTimeBase;
+	AVRational StreamTimeBase;
+	AVRational RFrameRate;
+	AVRational AvgFrameRate;
+	int64_t StartTime;
+	int64_t Duration;
+	std::vector<uint8_t> Extradata;
+
+	void Store(const AVStream *Stream);
+	void Apply(AVStream *Stream) const;
+
+	TCodecParams();
 };
 
 struct FFMS_Track : public std::vector<TFrameInfo> {
@@ -87,11 +119,17 @@ public:
 	FFMS_TrackTimeBase TB;
 	bool UseDTS;
 	bool HasTS;
+	// Set when the Reference flag of each frame was actually determined
+	// while indexing rather than just defaulted to true
+	bool HasReferenceInfo;
+	TCodecParams CodecParams;
 
 	int FindClosestVideoKeyFrame(int Frame);
+	int FindNearestKeyFrame(int Frame);
 	int FrameFromPTS(int64_t PTS);
 	int FrameFromPos(int64_t Pos);
 	int ClosestFrameFromPTS(int64_t PTS);
+	int ClosestFrameFromTime(double Time);
 	void WriteTimecodes(const char *TimecodeFile);
 
 	void MaybeReorderFrames();
@@ -142,7 +180,8 @@ protected:
 	void WriteAudio(SharedAudioContext &AudioContext, FFMS_Index *Index, int Track, int DBSize);
 	void CheckAudioProperties(int Track, AVCodecContext *Context);
 	int64_t IndexAudioPacket(int Track, AVPacket *Packet, SharedAudioContext &Context, FFMS_Index &TrackIndices);
-	void ParseVideoPacket(SharedVideoContext &VideoContext, AVPacket &pkt, int *RepeatPict, int *FrameType);
+	void ParseVideoPacket(SharedVideoContext &VideoContext, AVPacket &pkt, int *RepeatPict, int *FrameType, bool *Reference);
+	bool HasReferenceInfo(SharedVideoContext &VideoContext);
 
 public:
 	static FFMS_Indexer *CreateIndexer(const char *Filename, FFMS_Sources Demuxer = FFMS_SOURCE_DEFAULT);
@@ -0,0 +1,161 @@
+//  Copyright (c) 2012 Fredrik Mellbin
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#include "videosource.h"
+
+struct IntraBatch {
+	std::vector<IntraDecoder *> *Decoders;
+	std::vector<int> Frames;
+	std::vector<char> Decoded;
+};
+
+static void DecodeIntraJob(void *Arg, int Index) {
+	IntraBatch *Batch = static_cast<IntraBatch *>(Arg);
+	Batch->Decoded[Index] = (*Batch->Decoders)[Index]->Decode(Batch->Frames[Index]);
+}
+
+void FFMS_VideoSource::GetIntraFrames(const std::vector<std::pair<int, int> > &Requests, TFrameCallback FC, void *Private) {
+	IntraBatch Batch;
+	Batch.Decoders = &IntraDecoders;
+
+	size_t i = 0;
+	while (i < Requests.size()) {
+		// Give every decoder a different frame, repeated requests share one
+		size_t End = i;
+		Batch.Frames.clear();
+		for (; End < Requests.size(); End++) {
+			if (Batch.Frames.empty() || Batch.Frames.back() != Requests[End].first) {
+				if (Batch.Frames.size() == IntraDecoders.size())
+					break;
+				Batch.Frames.push_back(Requests[End].first);
+			}
+		}
+
+		Batch.Decoded.assign(Batch.Frames.size(), 0);
+		IntraPool->Run(DecodeIntraJob, &Batch, static_cast<int>(Batch.Frames.size()));
+
+		// Conversion happens here since the output state isn't shared with the pool
+		FFMS_Frame *Frame = NULL;
+		for (size_t b = 0; i < End; i++) {
+			if (Frame && Requests[i].first != Batch.Frames[b]) {
+				Frame = NULL;
+				b++;
+			}
+
+			if (!Frame) {
+				AVCodecContext *Context = IntraDecoders[b]->CodecContext;
+				if (Batch.Decoded[b] && Context->width == CodecContext->width
+					&& Context->height == CodecContext->height && Context->pix_fmt == CodecContext->pix_fmt) {
+					Frame = OutputFrame(IntraDecoders[b]->Frame);
+					LastFrameNum = -1;
+				} else {
+					Frame = GetFrame(Batch.Frames[b]);
+				}
+			}
+
+			if ((*FC)(Requests[i].first, Requests[i].second, Frame, Private))
+				throw FFMS_Exception(FFMS_ERROR_CANCELLED, FFMS_ERROR_USER,
+					"Cancelled by user");
+		}
+	}
+}
+
+bool FFMS_VideoSource::InitIntraDecoders() {
+	if (IntraPool.get())
+		return true;
+	if (!AllIntra || DecodingThreads < 2)
+		return false;
+
+	// Use as many decoders as could be opened, the main decoder still works if none could
+	try {
+		for (int i = 0; i < DecodingThreads; i++) {
+			IntraDecoder *Decoder = CreateIntraDecoder();
+			if (!Decoder)
+				break;
+			IntraDecoders.push_back(Decoder);
+		}
+	} catch (FFMS_Exception &) {
+	}
+
+	try {
+		if (IntraDecoders.size() > 1)
+			IntraPool.reset(new FFThreadPool(static_cast<int>(IntraDecoders.size())));
+	} catch (FFMS_Exception &) {
+	}
+
+	// Don't try again if the source can't provide independent decoders
+	if (!IntraPool.get()) {
+		FreeIntraDecoders();
+		AllIntra = false;
+		return false;
+	}
+
+	return true;
+}
+
+void FFMS_VideoSource::FreeIntraDecoders() {
+	IntraPool.reset();
+	for (size_t i = 0; i < IntraDecoders.size(); i++)
+		delete IntraDecoders[i];
+	IntraDecoders.clear();
+}
+
+IntraDecoder *FFMS_VideoSource::CreateIntraDecoder() {
+	return NULL;
+}
+
+IntraDecoder::IntraDecoder()
+: Opened(false)
+, CodecContext(NULL)
+, Frame(avcodec_alloc_frame())
+{
+	if (!Frame)
+		throw FFMS_Exception(FFMS_ERROR_DECODING, FFMS_ERROR_ALLOCATION_FAILED,
+			"Could not allocate video frame");
+}
+
+IntraDecoder::~IntraDecoder() {
+	av_freep(&Frame);
+}
+
+void IntraDecoder::Open(AVCodec *Codec) {
+	// The pool provides the parallelism, so each decoder only needs one thread
+	CodecContext->thread_count = 1;
+	if (avcodec_open2(CodecContext, Codec, NULL) < 0)
+		throw FFMS_Exception(FFMS_ERROR_DECODING, FFMS_ERROR_CODEC,
+			"Could not open video codec");
+	Opened = true;
+}
+
+bool IntraDecoder::DecodePacket(AVPacket &Packet) {
+	FlushBuffers(CodecContext);
+
+	int FrameFinished = 0;
+	avcodec_decode_video2(CodecContext, Frame, &FrameFinished, &Packet);
+	if (!FrameFinished) {
+		AVPacket NullPacket;
+		InitNullPacket(NullPacket);
+		avcodec_decode_video2(CodecContext, Frame, &FrameFinished, &NullPacket);
+	}
+
+	// A picture that isn't a keyframe depended on earlier packets, so the
+	// track wasn't really intra only
+	return FrameFinished && Frame->key_frame;
+}
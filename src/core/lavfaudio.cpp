@@ -26,7 +26,7 @@ FFLAVFAudio::FFLAVFAudio(const char *SourceFile, int Track, FFMS_Index &Index, i
 , FormatContext(NULL)
 , LastValidTS(AV_NOPTS_VALUE)
 {
-	LAVFOpenFile(SourceFile, FormatContext);
+	LAVFOpenFile(SourceFile, FormatContext, &Index);
 
 	CodecContext.reset(FormatContext->streams[TrackNumber]->codec);
 	assert(CodecContext);
@@ -50,6 +50,7 @@ FFMS_Index *FFLAVFIndexer::DoIndexing() {
 		TrackIndices->push_back(FFMS_Track((int64_t)FormatContext->streams[i]->time_base.num * 1000,
 			FormatContext->streams[i]->time_base.den,
 			static_cast<FFMS_TrackType>(FormatContext->streams[i]->codec->codec_type)));
+		(*TrackIndices)[i].CodecParams.Store(FormatContext->streams[i]);
 
 		if (FormatContext->streams[i]->codec->codec_type == AVMEDIA_TYPE_VIDEO) {
 			AVCodec *VideoCodec = avcodec_find_decoder(FormatContext->streams[i]->codec->codec_id);
@@ -65,6 +66,7 @@ FFMS_Index *FFLAVFIndexer::DoIndexing() {
 			VideoContexts[i].Parser = av_parser_init(FormatContext->streams[i]->codec->codec_id);
 			if (VideoContexts[i].Parser)
 				VideoContexts[i].Parser->flags = PARSER_FLAG_COMPLETE_FRAMES;
+			(*TrackIndices)[i].HasReferenceInfo = HasReferenceInfo(VideoContexts[i]);
 			IndexMask |= 1 << i;
 		}
 		else if (IndexMask & (1 << i) && FormatContext->streams[i]->codec->codec_type == AVMEDIA_TYPE_AUDIO) {
@@ -130,9 +132,10 @@ FFMS_Index *FFLAVFIndexer::DoIndexing() {
 
 			int RepeatPict = -1;
 			int FrameType = 0;
-			ParseVideoPacket(VideoContexts[Track], Packet, &RepeatPict, &FrameType);
+			bool Reference = true;
+			ParseVideoPacket(VideoContexts[Track], Packet, &RepeatPict, &FrameType, &Reference);
 
-			(*TrackIndices)[Track].push_back(TFrameInfo::VideoFrameInfo(PTS, RepeatPict, KeyFrame, FrameType, Packet.pos));
+			(*TrackIndices)[Track].push_back(TFrameInfo::VideoFrameInfo(PTS, RepeatPict, KeyFrame, FrameType, Reference, Packet.pos));
 		}
 		else if (FormatContext->streams[Track]->codec->codec_type == AVMEDIA_TYPE_AUDIO) {
 			int64_t StartSample = AudioContexts[Track].CurrentSample;
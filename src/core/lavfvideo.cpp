@@ -20,24 +20,74 @@
 
 #include "videosource.h"
 
+class LAVFIntraDecoder : public IntraDecoder {
+private:
+	AVFormatContext *FormatContext;
+	int VideoTrack;
+	FFMS_Track &Frames;
+public:
+	LAVFIntraDecoder(const char *SourceFile, int VideoTrack, FFMS_Track &Frames, const FFMS_Index &Index)
+	: FormatContext(NULL)
+	, VideoTrack(VideoTrack)
+	, Frames(Frames)
+	{
+		LAVFOpenFile(SourceFile, FormatContext, &Index);
+		CodecContext = FormatContext->streams[VideoTrack]->codec;
+	}
+
+	~LAVFIntraDecoder() {
+		if (Opened)
+			avcodec_close(CodecContext);
+		avformat_close_input(&FormatContext);
+	}
+
+	bool Decode(int n) {
+		// Every frame is a keyframe, so seeking to it directly is exact
+		if (av_seek_frame(FormatContext, VideoTrack, Frames[n].PTS, AVSEEK_FLAG_BACKWARD) < 0)
+			return false;
+
+		AVPacket Packet;
+		InitNullPacket(Packet);
+		while (av_read_frame(FormatContext, &Packet) >= 0) {
+			if (Packet.stream_index == VideoTrack) {
+				bool Decoded = false;
+				if ((Frames.UseDTS ? Packet.dts : Packet.pts) == Frames[n].PTS)
+					Decoded = DecodePacket(Packet);
+				av_free_packet(&Packet);
+				return Decoded;
+			}
+			av_free_packet(&Packet);
+		}
 
+		return false;
+	}
+};
 
 void FFLAVFVideo::Free(bool CloseCodec) {
 	if (CloseCodec)
 		avcodec_close(CodecContext);
-	avformat_close_input(&FormatContext);
+	if (FormatContext)
+		avformat_close_input(&FormatContext);
 }
 
 FFLAVFVideo::FFLAVFVideo(const char *SourceFile, int Track, FFMS_Index &Index,
-	int Threads, int SeekMode)
-: FFMS_VideoSource(SourceFile, Index, Track, Threads)
+	int Threads, int SeekMode, int Flags)
+: FFMS_VideoSource(SourceFile, Index, Track, Threads, Flags)
 , FormatContext(NULL)
 , SeekMode(SeekMode)
 , Res(FFSourceResources<FFMS_VideoSource>(this))
+, SourceFile(SourceFile)
+, ReplayPacket(-1)
+, ReplayFailed(false)
 {
+	if (!(Flags & FFMS_VSF_LAZY))
+		Open();
+}
+
+void FFLAVFVideo::OpenDecoder() {
 	AVCodec *Codec = NULL;
 
-	LAVFOpenFile(SourceFile, FormatContext);
+	LAVFOpenFile(SourceFile.c_str(), FormatContext, &Index);
 
 	if (SeekMode >= 0 && Frames.size() > 1 && av_seek_frame(FormatContext, VideoTrack, Frames[0].PTS, AVSEEK_FLAG_BACKWARD) < 0)
 		throw FFMS_Exception(FFMS_ERROR_DECODING, FFMS_ERROR_CODEC,
@@ -56,6 +106,8 @@ FFLAVFVideo::FFLAVFVideo(const char *SourceFile, int Track, FFMS_Index &Index,
 		throw FFMS_Exception(FFMS_ERROR_DECODING, FFMS_ERROR_CODEC,
 			"Video codec not found");
 
+	SetDecoderOptions(CodecContext, Codec);
+
 	if (avcodec_open2(CodecContext, Codec, NULL) < 0)
 		throw FFMS_Exception(FFMS_ERROR_DECODING, FFMS_ERROR_CODEC,
 			"Could not open video codec");
@@ -93,6 +145,49 @@ FFLAVFVideo::FFLAVFVideo(const char *SourceFile, int Track, FFMS_Index &Index,
 	OutputFrame(DecodeFrame);
 }
 
+bool FFLAVFVideo::CanReplay(int Start, int n) {
+	// Only bother when everything needed to get to the frame is there
+	int End = FFMIN(n + FFMS_CALCULATE_DELAY + 1, static_cast<int>(Frames.size()) - 1);
+	for (int i = Start; i <= End; i++)
+		if (!Packets.Has(Frames[i].OriginalPos))
+			return false;
+	return true;
+}
+
+bool FFLAVFVideo::ReadPacket(AVPacket &Packet) {
+	if (ReplayPacket >= 0) {
+		const AVPacket *Cached = NULL;
+		if (ReplayPacket < static_cast<int>(Frames.size()))
+			Cached = Packets.Get(Frames[ReplayPacket].OriginalPos);
+		if (!Cached) {
+			ReplayFailed = true;
+			return false;
+		}
+
+		// A copy which doesn't own the data, so freeing it leaves the cache intact
+		InitNullPacket(Packet);
+		Packet.data = Cached->data;
+		Packet.size = Cached->size;
+		Packet.pts = Cached->pts;
+		Packet.dts = Cached->dts;
+		Packet.pos = Cached->pos;
+		Packet.flags = Cached->flags;
+		Packet.stream_index = Cached->stream_index;
+		ReplayPacket++;
+		return true;
+	}
+
+	if (av_read_frame(FormatContext, &Packet) < 0)
+		return false;
+
+	if (Packet.stream_index == VideoTrack) {
+		int n = Frames.FrameFromPTS(Frames.UseDTS ? Packet.dts : Packet.pts);
+		if (n >= 0)
+			Packets.Put(n, Packet);
+	}
+	return true;
+}
+
 void FFLAVFVideo::DecodeNextFrame(int64_t *AStartTime, int64_t *Pos) {
 	AVPacket Packet;
 	InitNullPacket(Packet);
@@ -108,7 +203,7 @@ void FFLAVFVideo::DecodeNextFrame(int64_t *AStartTime, int64_t *Pos) {
 		}
 	}
 
-	while (av_read_frame(FormatContext, &Packet) >= 0) {
+	while (ReadPacket(Packet)) {
 		if (Packet.stream_index == VideoTrack) {
 			if (*AStartTime < 0) {
 				if (Frames.UseDTS)
@@ -120,7 +215,8 @@ void FFLAVFVideo::DecodeNextFrame(int64_t *AStartTime, int64_t *Pos) {
 			if (*Pos < 0)
 				*Pos = Packet.pos;
 
-			avcodec_decode_video2(CodecContext, DecodeFrame, &FrameFinished, &Packet);
+			if (Frames.UseDTS || !CanDropPacket(Frames.FrameFromPTS(Packet.pts)))
+				avcodec_decode_video2(CodecContext, DecodeFrame, &FrameFinished, &Packet);
 
 			if (!FrameFinished)
 				DelayCounter++;
@@ -136,6 +232,11 @@ void FFLAVFVideo::DecodeNextFrame(int64_t *AStartTime, int64_t *Pos) {
 			goto Done;
 	}
 
+	// Running out of cached packets isn't the end of the stream, GetFrame
+	// seeks for real instead
+	if (ReplayFailed)
+		goto Done;
+
 	// Flush the last frames
 	if (FFMS_CALCULATE_DELAY) {
 		AVPacket NullPacket;
@@ -148,12 +249,65 @@ void FFLAVFVideo::DecodeNextFrame(int64_t *AStartTime, int64_t *Pos) {
 
 Error:
 Done:
+	if (FrameFinished)
+		DecodedPictures++;
 	if (InitialDecode == 1) InitialDecode = -1;
 }
 
+bool FFLAVFVideo::DecodeKeyFrame(int n) {
+	// Linear access can't jump to the keyframe and then continue
+	if (SeekMode <= 0)
+		return false;
+
+	// Any failure from here on leaves the demuxer somewhere unknown
+	CurrentFrame = Frames.size();
+	ReplayPacket = -1;
+
+	if (av_seek_frame(FormatContext, VideoTrack, Frames[n].PTS, AVSEEK_FLAG_BACKWARD) < 0)
+		return false;
+
+	AVPacket Packet;
+	InitNullPacket(Packet);
+	while (av_read_frame(FormatContext, &Packet) >= 0) {
+		if (Packet.stream_index == VideoTrack) {
+			// Only decode the packet if it's really the one wanted
+			bool Decoded = false;
+			if ((Frames.UseDTS ? Packet.dts : Packet.pts) == Frames[n].PTS)
+				Decoded = DecodeSinglePacket(Packet);
+			av_free_packet(&Packet);
+			return Decoded;
+		}
+		av_free_packet(&Packet);
+	}
+
+	return false;
+}
+
+IntraDecoder *FFLAVFVideo::CreateIntraDecoder() {
+	// Each decoder has to be able to seek straight to its frame
+	if (SeekMode <= 0)
+		return NULL;
+
+	std::auto_ptr<LAVFIntraDecoder> Decoder(new LAVFIntraDecoder(SourceFile.c_str(), VideoTrack, Frames, Index));
+	SetDecoderOptions(Decoder->CodecContext, CodecContext->codec);
+	Decoder->Open(CodecContext->codec);
+	return Decoder.release();
+}
+
+FFMS_VideoSource *FFLAVFVideo::Duplicate() {
+	if (SeekMode < 0)
+		return NULL;
+	// Opened here so that the copy doesn't open on the thread that uses it
+	return new FFLAVFVideo(SourceFile.c_str(), VideoTrack, Index, DecodingThreads, SeekMode, SourceFlags & ~FFMS_VSF_LAZY);
+}
+
 FFMS_Frame *FFLAVFVideo::GetFrame(int n) {
 	GetFrameCheck(n);
 
+	FFMS_Frame *Buffered = GetCachedFrame(n);
+	if (Buffered)
+		return Buffered;
+
 	if (LastFrameNum == n)
 		return &LocalFrame;
 
@@ -166,6 +320,7 @@ FFMS_Frame *FFLAVFVideo::GetFrame(int n) {
 
 		if (SeekMode == 0) {
 			if (n < CurrentFrame) {
+				ReplayPacket = -1;
 				av_seek_frame(FormatContext, VideoTrack, Frames[0].PTS, AVSEEK_FLAG_BACKWARD);
 				FlushBuffers(CodecContext);
 				CurrentFrame = 0;
@@ -175,12 +330,22 @@ FFMS_Frame *FFLAVFVideo::GetFrame(int n) {
 		} else {
 			// 10 frames is used as a margin to prevent excessive seeking since the predicted best keyframe isn't always selected by avformat
 			if (n < CurrentFrame || ClosestKF > CurrentFrame + 10 || (SeekMode == 3 && n > CurrentFrame + 10)) {
+				// Keeping packets around only pays off once something goes backwards
+				if (n < CurrentFrame)
+					Packets.Activate();
+				if (CanReplay(ClosestKF, n)) {
+					// Decode the cached packets instead of seeking and demuxing
+					ReplayPacket = ClosestKF;
+					CurrentFrame = Frames[ClosestKF].OriginalPos;
+				} else {
 ReSeek:
-				av_seek_frame(FormatContext, VideoTrack,
-					(SeekMode == 3) ? Frames[n].PTS : Frames[ClosestKF + SeekOffset].PTS,
-					AVSEEK_FLAG_BACKWARD);
+					ReplayPacket = -1;
+					av_seek_frame(FormatContext, VideoTrack,
+						(SeekMode == 3) ? Frames[n].PTS : Frames[ClosestKF + SeekOffset].PTS,
+						AVSEEK_FLAG_BACKWARD);
+					HasSeeked = true;
+				}
 				FlushBuffers(CodecContext);
-				HasSeeked = true;
 				DelayCounter = 0;
 				InitialDecode = 1;
 			}
@@ -191,14 +356,20 @@ ReSeek:
 	}
 
 	do {
-		if (CurrentFrame + FFMS_CALCULATE_DELAY >= n)
-			CodecContext->skip_frame = AVDISCARD_DEFAULT;
-		else
-			CodecContext->skip_frame = AVDISCARD_NONREF;
+		// Where the decoder is isn't known yet right after a seek
+		if (!HasSeeked)
+			CheckAbort();
+
+		SetSkipFrame(n);
 
 		int64_t StartTime = ffms_av_nopts_value, FilePos = -1;
 		DecodeNextFrame(&StartTime, &FilePos);
 
+		if (ReplayFailed) {
+			ReplayFailed = false;
+			goto ReSeek;
+		}
+
 		if (HasSeeked) {
 			HasSeeked = false;
 
@@ -241,9 +412,11 @@ ReSeek:
 		}
 
 SkipReSeek:
+		StoreAnchor(CurrentFrame);
+		StoreReversePicture();
 		CurrentFrame++;
 	} while (CurrentFrame <= n);
 
 	LastFrameNum = n;
-	return OutputFrame(DecodeFrame);
+	return OutputDecodeFrame();
 }
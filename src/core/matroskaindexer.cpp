@@ -85,6 +85,7 @@ FFMS_Index *FFMatroskaIndexer::DoIndexing() {
 
 				VideoContexts[i].CodecContext = CodecContext;
 				VideoContexts[i].Parser->flags = PARSER_FLAG_COMPLETE_FRAMES;
+				(*TrackIndices)[i].HasReferenceInfo = HasReferenceInfo(VideoContexts[i]);
 			}
 			else if (IndexMask & (1 << i) && TI->Type == TT_AUDIO) {
 				if (avcodec_open2(CodecContext, Codec[i], NULL) < 0)
@@ -136,9 +137,10 @@ FFMS_Index *FFMatroskaIndexer::DoIndexing() {
 
 			int RepeatPict = -1;
 			int FrameType = 0;
-			ParseVideoPacket(VideoContexts[Track], TempPacket, &RepeatPict, &FrameType);
+			bool Reference = true;
+			ParseVideoPacket(VideoContexts[Track], TempPacket, &RepeatPict, &FrameType, &Reference);
 
-			(*TrackIndices)[Track].push_back(TFrameInfo::VideoFrameInfo(StartTime, RepeatPict, (FrameFlags & FRAME_KF) != 0, FrameType, FilePos, CompressedFrameSize));
+			(*TrackIndices)[Track].push_back(TFrameInfo::VideoFrameInfo(StartTime, RepeatPict, (FrameFlags & FRAME_KF) != 0, FrameType, Reference, FilePos, CompressedFrameSize));
 		} else if (TrackType == TT_AUDIO && (IndexMask & (1 << Track))) {
 			int64_t StartSample = AudioContexts[Track].CurrentSample;
 			int64_t SampleCount = IndexAudioPacket(Track, &TempPacket, AudioContexts[Track], *TrackIndices);
@@ -22,7 +22,79 @@
 
 #include "codectype.h"
 
+// Has its own copy of everything it reads with, since the decoders run on
+// the pool threads at the same time and may outlive the main reader
+class MatroskaIntraDecoder : public IntraDecoder {
+private:
+	MatroskaReaderContext MC;
+	MatroskaFile *MF;
+	std::auto_ptr<TrackCompressionContext> TCC;
+	FFMS_Track &Frames;
+	char ErrorMessage[256];
+public:
+	MatroskaIntraDecoder(const char *SourceFile, int VideoTrack, FFMS_Track &Frames)
+	: MF(NULL)
+	, Frames(Frames)
+	{
+		MC.ST.fp = ffms_fopen(SourceFile, "rb");
+		if (MC.ST.fp == NULL) {
+			std::ostringstream buf;
+			buf << "Can't open '" << SourceFile << "': " << strerror(errno);
+			throw FFMS_Exception(FFMS_ERROR_PARSER, FFMS_ERROR_FILE_READ, buf.str());
+		}
+
+		MF = mkv_OpenEx(&MC.ST.base, 0, 0, ErrorMessage, sizeof(ErrorMessage));
+		if (MF == NULL) {
+			std::ostringstream buf;
+			buf << "Can't parse Matroska file: " << ErrorMessage;
+			throw FFMS_Exception(FFMS_ERROR_PARSER, FFMS_ERROR_FILE_READ, buf.str());
+		}
+
+		TrackInfo *TI = mkv_GetTrackInfo(MF, VideoTrack);
+		try {
+			if (TI->CompEnabled)
+				TCC.reset(new TrackCompressionContext(MF, TI, VideoTrack));
+
+			CodecContext = avcodec_alloc_context3(NULL);
+		} catch (...) {
+			mkv_Close(MF);
+			throw;
+		}
+		if (!CodecContext) {
+			mkv_Close(MF);
+			throw FFMS_Exception(FFMS_ERROR_DECODING, FFMS_ERROR_ALLOCATION_FAILED,
+				"Could not allocate codec context");
+		}
+		InitializeCodecContextFromMatroskaTrackInfo(TI, CodecContext);
+	}
+
+	~MatroskaIntraDecoder() {
+		if (Opened)
+			avcodec_close(CodecContext);
+		av_freep(&CodecContext);
+		TCC.reset();
+		mkv_Close(MF);
+	}
+
+	bool Decode(int n) {
+		// The index has the position and size of every packet so no parsing is needed
+		const TFrameInfo &FI = Frames[n];
+		unsigned int FrameSize = FI.FrameSize;
+		ReadFrame(FI.FilePos, FrameSize, TCC.get(), MC);
+
+		AVPacket Packet;
+		InitNullPacket(Packet);
+		Packet.data = MC.Buffer;
+		Packet.size = FrameSize;
+		Packet.flags = AV_PKT_FLAG_KEY;
+
+		return DecodePacket(Packet);
+	}
+};
+
 void FFMatroskaVideo::Free(bool CloseCodec) {
+	// The base class destructor runs too late for the pool, which uses the codec
+	FreeIntraDecoders();
 	TCC.reset();
 	if (MC.ST.fp) {
 		mkv_Close(MF);
@@ -33,16 +105,22 @@ void FFMatroskaVideo::Free(bool CloseCodec) {
 }
 
 FFMatroskaVideo::FFMatroskaVideo(const char *SourceFile, int Track,
-	FFMS_Index &Index, int Threads)
-: FFMS_VideoSource(SourceFile, Index, Track, Threads)
+	FFMS_Index &Index, int Threads, int Flags)
+: FFMS_VideoSource(SourceFile, Index, Track, Threads, Flags)
 , MF(0)
 , Res(FFSourceResources<FFMS_VideoSource>(this))
 , PacketNumber(0)
+, SourceFile(SourceFile)
 {
+	if (!(Flags & FFMS_VSF_LAZY))
+		Open();
+}
+
+void FFMatroskaVideo::OpenDecoder() {
 	AVCodec *Codec = NULL;
 	TrackInfo *TI = NULL;
 
-	MC.ST.fp = ffms_fopen(SourceFile, "rb");
+	MC.ST.fp = ffms_fopen(SourceFile.c_str(), "rb");
 	if (MC.ST.fp == NULL) {
 		std::ostringstream buf;
 		buf << "Can't open '" << SourceFile << "': " << strerror(errno);
@@ -77,6 +155,7 @@ FFMatroskaVideo::FFMatroskaVideo(const char *SourceFile, int Track,
 			"Video codec not found");
 
 	InitializeCodecContextFromMatroskaTrackInfo(TI, CodecContext);
+	SetDecoderOptions(CodecContext, Codec);
 
 	if (avcodec_open2(CodecContext, Codec, NULL) < 0)
 		throw FFMS_Exception(FFMS_ERROR_DECODING, FFMS_ERROR_CODEC,
@@ -135,11 +214,30 @@ void FFMatroskaVideo::DecodeNextFrame() {
 		// presentation order and not decoding order, this is unnoticeable
 		// in the other sources where less is done manually
 		const TFrameInfo &FI = Frames[Frames[PacketNumber].OriginalPos];
-		FrameSize = FI.FrameSize;
-		ReadFrame(FI.FilePos, FrameSize, TCC.get(), MC);
 
-		Packet.data = MC.Buffer;
-		Packet.size = FrameSize;
+		// Frames nothing depends on don't even have to be read
+		if (CanDropPacket(Frames[PacketNumber].OriginalPos)) {
+			PacketNumber++;
+			DelayCounter++;
+			if (DelayCounter > FFMS_CALCULATE_DELAY && !InitialDecode)
+				goto Done;
+			continue;
+		}
+
+		// Packets of recently decoded GOPs don't have to be read again
+		const AVPacket *Cached = Packets.Get(Frames[PacketNumber].OriginalPos);
+		if (Cached) {
+			Packet.data = Cached->data;
+			Packet.size = Cached->size;
+		} else {
+			FrameSize = FI.FrameSize;
+			ReadFrame(FI.FilePos, FrameSize, TCC.get(), MC);
+
+			Packet.data = MC.Buffer;
+			Packet.size = FrameSize;
+			Packets.Put(Frames[PacketNumber].OriginalPos, Packet);
+		}
+
 		if (FI.KeyFrame)
 			Packet.flags = AV_PKT_FLAG_KEY;
 		else
@@ -170,17 +268,52 @@ void FFMatroskaVideo::DecodeNextFrame() {
 
 Error:
 Done:
+	if (FrameFinished)
+		DecodedPictures++;
 	if (InitialDecode == 1) InitialDecode = -1;
 }
 
+bool FFMatroskaVideo::DecodeKeyFrame(int n) {
+	const TFrameInfo &FI = Frames[n];
+	unsigned int FrameSize = FI.FrameSize;
+	ReadFrame(FI.FilePos, FrameSize, TCC.get(), MC);
+
+	AVPacket Packet;
+	InitNullPacket(Packet);
+	Packet.data = MC.Buffer;
+	Packet.size = FrameSize;
+	Packet.flags = AV_PKT_FLAG_KEY;
+
+	return DecodeSinglePacket(Packet);
+}
+
+IntraDecoder *FFMatroskaVideo::CreateIntraDecoder() {
+	std::auto_ptr<MatroskaIntraDecoder> Decoder(new MatroskaIntraDecoder(SourceFile.c_str(), VideoTrack, Frames));
+	SetDecoderOptions(Decoder->CodecContext, CodecContext->codec);
+	Decoder->Open(CodecContext->codec);
+	return Decoder.release();
+}
+
+FFMS_VideoSource *FFMatroskaVideo::Duplicate() {
+	// Opened here so that the copy doesn't open on the thread that uses it
+	return new FFMatroskaVideo(SourceFile.c_str(), VideoTrack, Index, DecodingThreads, SourceFlags & ~FFMS_VSF_LAZY);
+}
+
 FFMS_Frame *FFMatroskaVideo::GetFrame(int n) {
 	GetFrameCheck(n);
 
+	FFMS_Frame *Buffered = GetCachedFrame(n);
+	if (Buffered)
+		return Buffered;
+
 	if (LastFrameNum == n)
 		return &LocalFrame;
 
 	int ClosestKF = Frames.FindClosestVideoKeyFrame(n);
 	if (CurrentFrame > n || ClosestKF > CurrentFrame + 10) {
+		// Keeping packets around only pays off once something goes backwards
+		if (CurrentFrame > n)
+			Packets.Activate();
 		DelayCounter = 0;
 		InitialDecode = 1;
 		PacketNumber = ClosestKF;
@@ -189,14 +322,14 @@ FFMS_Frame *FFMatroskaVideo::GetFrame(int n) {
 	}
 
 	do {
-		if (CurrentFrame + FFMS_CALCULATE_DELAY >= n)
-			CodecContext->skip_frame = AVDISCARD_DEFAULT;
-		else
-			CodecContext->skip_frame = AVDISCARD_NONREF;
+		CheckAbort();
+		SetSkipFrame(n);
 		DecodeNextFrame();
+		StoreAnchor(CurrentFrame);
+		StoreReversePicture();
 		CurrentFrame++;
 	} while (CurrentFrame <= n);
 
 	LastFrameNum = n;
-	return OutputFrame(DecodeFrame);
+	return OutputDecodeFrame();
 }
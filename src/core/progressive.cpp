@@ -0,0 +1,186 @@
+//  Copyright (c) 2012 Fredrik Mellbin
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#include "videosource.h"
+
+ProgressiveRefiner::ProgressiveRefiner(FFMS_VideoSource *Source)
+: Source(Source)
+, Applied(Source->GetOutputSettings())
+, Frame(0)
+, Callback(NULL)
+, Private(NULL)
+, Request(0)
+, Started(0)
+, Pending(false)
+, Running(false)
+, Quit(false)
+{
+	Source->Refining = this;
+	Thread.reset(new FFThread(ThreadMain, this));
+}
+
+ProgressiveRefiner::~ProgressiveRefiner() {
+	Lock.Lock();
+	Quit = true;
+	Request++;
+	Wake.Signal();
+	Lock.Unlock();
+	Thread.reset();
+}
+
+void ProgressiveRefiner::ThreadMain(void *Refiner) {
+	static_cast<ProgressiveRefiner *>(Refiner)->Refine();
+}
+
+void ProgressiveRefiner::Refine() {
+	FFScopedLock L(Lock);
+	for (;;) {
+		while (!Quit && !Pending)
+			Wake.Wait(Lock);
+		if (Quit)
+			return;
+
+		Pending = false;
+		Running = true;
+		Started = Request;
+		int n = Frame;
+		OutputSettings CurrentSettings = Settings;
+		TExactFrameCallback CurrentCallback = Callback;
+		void *CurrentPrivate = Private;
+		Lock.Unlock();
+
+		const FFMS_Frame *Result = NULL;
+		bool Cancelled = false;
+		try {
+			if (!(CurrentSettings == Applied)) {
+				Source->ApplyOutputSettings(CurrentSettings);
+				Applied = CurrentSettings;
+			}
+			Result = Source->GetFrame(n);
+		} catch (FFMS_Exception &) {
+			Cancelled = Aborted();
+		} catch (...) {
+		}
+
+		// A failure is reported as a null frame, a superseded request not at all
+		if (!Cancelled && !Aborted())
+			CurrentCallback(n, Result, CurrentPrivate);
+
+		Lock.Lock();
+		Running = false;
+		Idle.Broadcast();
+	}
+}
+
+bool ProgressiveRefiner::Aborted() {
+	FFScopedLock L(Lock);
+	return Quit || Started != Request;
+}
+
+void ProgressiveRefiner::Post(int n, const OutputSettings &Settings, TExactFrameCallback Callback, void *Private) {
+	FFScopedLock L(Lock);
+	Request++;
+	Frame = n;
+	this->Settings = Settings;
+	this->Callback = Callback;
+	this->Private = Private;
+	Pending = true;
+	Wake.Signal();
+}
+
+void ProgressiveRefiner::Cancel(bool Wait) {
+	FFScopedLock L(Lock);
+	Request++;
+	Pending = false;
+	// The callback calling this is the one that would be waited for
+	if (Thread->IsCurrent())
+		return;
+	while (Wait && Running)
+		Idle.Wait(Lock);
+}
+
+FFMS_Frame *FFMS_VideoSource::GetFrameProgressive(int n, int MaxDecode, int *FrameNum, TExactFrameCallback EFC, void *Private) {
+	GetFrameCheck(n);
+
+	// Whatever was still being refined is stale now
+	if (Refiner.get())
+		Refiner->Cancel(false);
+
+	if (FrameNum)
+		*FrameNum = n;
+
+	if (DecodeCost(n) <= MaxDecode || !EFC)
+		return GetFrame(n);
+
+	if (!Refiner.get()) {
+		FFMS_VideoSource *Copy = Duplicate();
+		if (!Copy)
+			return GetFrame(n);
+		Refiner.reset(new ProgressiveRefiner(Copy));
+	}
+
+	// Show whichever of the last output frame, the anchor before n in its
+	// GOP and the nearest keyframe is closest, the first two cost no
+	// decoding at all and the keyframe a single packet
+	FFMS_Frame *Frame;
+	int Approximate = Frames.FindNearestKeyFrame(n);
+	int Anchor = NearestAnchor(n);
+	if (LastFrameNum >= 0 && FFABS(LastFrameNum - n) <= FFABS(Approximate - n) &&
+		(Anchor < 0 || FFABS(LastFrameNum - n) <= FFABS(Anchor - n))) {
+		Approximate = LastFrameNum;
+		Frame = &LocalFrame;
+	} else if (Anchor >= 0 && FFABS(Anchor - n) <= FFABS(Approximate - n)) {
+		Approximate = Anchor;
+		Frame = OutputAnchor(Anchor);
+	} else {
+		Frame = GetNearestKeyFrame(n, &Approximate);
+	}
+
+	if (FrameNum)
+		*FrameNum = Approximate;
+	if (Approximate != n)
+		Refiner->Post(n, GetOutputSettings(), EFC, Private);
+	return Frame;
+}
+
+void FFMS_VideoSource::CancelProgressive() {
+	if (Refiner.get())
+		Refiner->Cancel(true);
+}
+
+int FFMS_VideoSource::DecodeCost(int n) {
+	if (n == LastFrameNum || NearestAnchor(n) == n)
+		return 0;
+
+	// Roughly the same decision GetFrame makes about seeking
+	int ClosestKF = Frames.FindClosestVideoKeyFrame(n);
+	if (n >= CurrentFrame && ClosestKF <= CurrentFrame + 10)
+		return n - CurrentFrame + 1;
+	return n - ClosestKF + 1;
+}
+
+void FFMS_VideoSource::CheckAbort() {
+	if (Refining && Refining->Aborted()) {
+		// The decoder has moved on from whatever LocalFrame was made from
+		LastFrameNum = -1;
+		throw FFMS_Exception(FFMS_ERROR_CANCELLED, FFMS_ERROR_USER,
+			"Superseded by a newer request");
+	}
+}
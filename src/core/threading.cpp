@@ -0,0 +1,383 @@
+//  Copyright (c) 2012 Fredrik Mellbin
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <process.h>
+#else
+#include <pthread.h>
+#endif
+
+#include "threading.h"
+
+struct ThreadStart {
+	void (*Func)(void *);
+	void *Arg;
+	ThreadStart(void (*Func)(void *), void *Arg) : Func(Func), Arg(Arg) { }
+};
+
+#ifdef _WIN32
+static unsigned __stdcall ThreadTrampoline(void *Start) {
+#else
+static void *ThreadTrampoline(void *Start) {
+#endif
+	ThreadStart S = *static_cast<ThreadStart *>(Start);
+	delete static_cast<ThreadStart *>(Start);
+	S.Func(S.Arg);
+	return 0;
+}
+
+#ifdef _WIN32
+
+FFMutex::FFMutex() {
+	CRITICAL_SECTION *CS = new CRITICAL_SECTION;
+	InitializeCriticalSection(CS);
+	Handle = CS;
+}
+
+FFMutex::~FFMutex() {
+	DeleteCriticalSection(static_cast<CRITICAL_SECTION *>(Handle));
+	delete static_cast<CRITICAL_SECTION *>(Handle);
+}
+
+void FFMutex::Lock() {
+	EnterCriticalSection(static_cast<CRITICAL_SECTION *>(Handle));
+}
+
+void FFMutex::Unlock() {
+	LeaveCriticalSection(static_cast<CRITICAL_SECTION *>(Handle));
+}
+
+#if _WIN32_WINNT >= 0x0600
+
+FFCondition::FFCondition() {
+	CONDITION_VARIABLE *CV = new CONDITION_VARIABLE;
+	InitializeConditionVariable(CV);
+	Handle = CV;
+}
+
+FFCondition::~FFCondition() {
+	delete static_cast<CONDITION_VARIABLE *>(Handle);
+}
+
+void FFCondition::Wait(FFMutex &Mutex) {
+	SleepConditionVariableCS(static_cast<CONDITION_VARIABLE *>(Handle), static_cast<CRITICAL_SECTION *>(Mutex.Handle), INFINITE);
+}
+
+void FFCondition::Signal() {
+	WakeConditionVariable(static_cast<CONDITION_VARIABLE *>(Handle));
+}
+
+void FFCondition::Broadcast() {
+	WakeAllConditionVariable(static_cast<CONDITION_VARIABLE *>(Handle));
+}
+
+#else
+
+// XP has no condition variables, so they're built from a semaphore the
+// waiters sleep on and an event the last woken waiter sets to say that
+// all of them have taken their wakeup. This is the same scheme as the
+// fallback in libavcodec's w32pthreads.h.
+struct Win32Condition {
+	CRITICAL_SECTION WakeLock; // held while waking so wakeups don't overlap
+	CRITICAL_SECTION CountLock;
+	int Waiters;
+	bool IsBroadcast;
+	HANDLE Semaphore;
+	HANDLE WaitersDone;
+};
+
+FFCondition::FFCondition() {
+	Win32Condition *C = new Win32Condition;
+	C->Semaphore = CreateSemaphore(NULL, 0, 0x7fffffff, NULL);
+	C->WaitersDone = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (!C->Semaphore || !C->WaitersDone) {
+		if (C->Semaphore)
+			CloseHandle(C->Semaphore);
+		if (C->WaitersDone)
+			CloseHandle(C->WaitersDone);
+		delete C;
+		throw FFMS_Exception(FFMS_ERROR_DECODING, FFMS_ERROR_ALLOCATION_FAILED, "Could not create condition variable");
+	}
+	InitializeCriticalSection(&C->WakeLock);
+	InitializeCriticalSection(&C->CountLock);
+	C->Waiters = 0;
+	C->IsBroadcast = false;
+	Handle = C;
+}
+
+FFCondition::~FFCondition() {
+	Win32Condition *C = static_cast<Win32Condition *>(Handle);
+	CloseHandle(C->Semaphore);
+	CloseHandle(C->WaitersDone);
+	DeleteCriticalSection(&C->WakeLock);
+	DeleteCriticalSection(&C->CountLock);
+	delete C;
+}
+
+void FFCondition::Wait(FFMutex &Mutex) {
+	Win32Condition *C = static_cast<Win32Condition *>(Handle);
+
+	// Waiting for WakeLock keeps a new waiter from taking a wakeup meant for the old ones
+	EnterCriticalSection(&C->WakeLock);
+	EnterCriticalSection(&C->CountLock);
+	C->Waiters++;
+	LeaveCriticalSection(&C->CountLock);
+	LeaveCriticalSection(&C->WakeLock);
+
+	Mutex.Unlock();
+	WaitForSingleObject(C->Semaphore, INFINITE);
+
+	EnterCriticalSection(&C->CountLock);
+	C->Waiters--;
+	bool Last = !C->Waiters || !C->IsBroadcast;
+	LeaveCriticalSection(&C->CountLock);
+	if (Last)
+		SetEvent(C->WaitersDone);
+
+	Mutex.Lock();
+}
+
+void FFCondition::Signal() {
+	Win32Condition *C = static_cast<Win32Condition *>(Handle);
+
+	EnterCriticalSection(&C->WakeLock);
+	EnterCriticalSection(&C->CountLock);
+	bool HaveWaiters = C->Waiters > 0;
+	LeaveCriticalSection(&C->CountLock);
+
+	if (HaveWaiters) {
+		ReleaseSemaphore(C->Semaphore, 1, NULL);
+		WaitForSingleObject(C->WaitersDone, INFINITE);
+		ResetEvent(C->WaitersDone);
+	}
+	LeaveCriticalSection(&C->WakeLock);
+}
+
+void FFCondition::Broadcast() {
+	Win32Condition *C = static_cast<Win32Condition *>(Handle);
+
+	EnterCriticalSection(&C->WakeLock);
+	EnterCriticalSection(&C->CountLock);
+	int Count = C->Waiters;
+	if (Count > 0)
+		C->IsBroadcast = true;
+	LeaveCriticalSection(&C->CountLock);
+
+	if (Count > 0) {
+		ReleaseSemaphore(C->Semaphore, Count, NULL);
+		WaitForSingleObject(C->WaitersDone, INFINITE);
+		ResetEvent(C->WaitersDone);
+		C->IsBroadcast = false;
+	}
+	LeaveCriticalSection(&C->WakeLock);
+}
+
+#endif
+
+FFThread::FFThread(void (*Func)(void *), void *Arg) {
+	ThreadStart *Start = new ThreadStart(Func, Arg);
+	Handle = reinterpret_cast<void *>(_beginthreadex(NULL, 0, ThreadTrampoline, Start, 0, &Id));
+	if (!Handle) {
+		delete Start;
+		throw FFMS_Exception(FFMS_ERROR_DECODING, FFMS_ERROR_ALLOCATION_FAILED, "Could not create thread");
+	}
+}
+
+FFThread::~FFThread() {
+	WaitForSingleObject(Handle, INFINITE);
+	CloseHandle(Handle);
+}
+
+bool FFThread::IsCurrent() const {
+	return GetCurrentThreadId() == Id;
+}
+
+#else
+
+FFMutex::FFMutex() {
+	pthread_mutex_t *M = new pthread_mutex_t;
+	pthread_mutex_init(M, NULL);
+	Handle = M;
+}
+
+FFMutex::~FFMutex() {
+	pthread_mutex_destroy(static_cast<pthread_mutex_t *>(Handle));
+	delete static_cast<pthread_mutex_t *>(Handle);
+}
+
+void FFMutex::Lock() {
+	pthread_mutex_lock(static_cast<pthread_mutex_t *>(Handle));
+}
+
+void FFMutex::Unlock() {
+	pthread_mutex_unlock(static_cast<pthread_mutex_t *>(Handle));
+}
+
+FFCondition::FFCondition() {
+	pthread_cond_t *C = new pthread_cond_t;
+	pthread_cond_init(C, NULL);
+	Handle = C;
+}
+
+FFCondition::~FFCondition() {
+	pthread_cond_destroy(static_cast<pthread_cond_t *>(Handle));
+	delete static_cast<pthread_cond_t *>(Handle);
+}
+
+void FFCondition::Wait(FFMutex &Mutex) {
+	pthread_cond_wait(static_cast<pthread_cond_t *>(Handle), static_cast<pthread_mutex_t *>(Mutex.Handle));
+}
+
+void FFCondition::Signal() {
+	pthread_cond_signal(static_cast<pthread_cond_t *>(Handle));
+}
+
+void FFCondition::Broadcast() {
+	pthread_cond_broadcast(static_cast<pthread_cond_t *>(Handle));
+}
+
+FFThread::FFThread(void (*Func)(void *), void *Arg) {
+	ThreadStart *Start = new ThreadStart(Func, Arg);
+	pthread_t *T = new pthread_t;
+	if (pthread_create(T, NULL, ThreadTrampoline, Start)) {
+		delete Start;
+		delete T;
+		throw FFMS_Exception(FFMS_ERROR_DECODING, FFMS_ERROR_ALLOCATION_FAILED, "Could not create thread");
+	}
+	Handle = T;
+	Id = 0;
+}
+
+FFThread::~FFThread() {
+	pthread_join(*static_cast<pthread_t *>(Handle), NULL);
+	delete static_cast<pthread_t *>(Handle);
+}
+
+bool FFThread::IsCurrent() const {
+	return !!pthread_equal(pthread_self(), *static_cast<pthread_t *>(Handle));
+}
+
+#endif
+
+FFThreadPool::FFThreadPool(int Threads)
+: Job(NULL)
+, Arg(NULL)
+, NextJob(0)
+, JobCount(0)
+, Busy(0)
+, Generation(0)
+, Quit(false)
+, Error(NULL)
+{
+	try {
+		for (int i = 1; i < Threads; i++)
+			Workers.push_back(new FFThread(WorkerMain, this));
+	} catch (...) {
+		Stop();
+		throw;
+	}
+}
+
+FFThreadPool::~FFThreadPool() {
+	Stop();
+}
+
+void FFThreadPool::Stop() {
+	Lock.Lock();
+	Quit = true;
+	WorkAvailable.Broadcast();
+	Lock.Unlock();
+
+	for (size_t i = 0; i < Workers.size(); i++)
+		delete Workers[i];
+	Workers.clear();
+	delete Error;
+	Error = NULL;
+}
+
+void FFThreadPool::WorkerMain(void *Pool) {
+	FFThreadPool *Self = static_cast<FFThreadPool *>(Pool);
+	unsigned Seen = 0;
+
+	FFScopedLock L(Self->Lock);
+	for (;;) {
+		while (!Self->Quit && Self->Generation == Seen)
+			Self->WorkAvailable.Wait(Self->Lock);
+		if (Self->Quit)
+			return;
+		Seen = Self->Generation;
+		Self->RunJobs();
+	}
+}
+
+// Called with Lock held
+void FFThreadPool::RunJobs() {
+	Busy++;
+	while (NextJob < JobCount) {
+		int Index = NextJob++;
+		Lock.Unlock();
+		try {
+			Job(Arg, Index);
+			Lock.Lock();
+		} catch (FFMS_Exception &e) {
+			Lock.Lock();
+			if (!Error)
+				Error = new FFMS_Exception(e);
+			NextJob = JobCount;
+		} catch (...) {
+			Lock.Lock();
+			if (!Error)
+				Error = new FFMS_Exception(FFMS_ERROR_DECODING, FFMS_ERROR_UNKNOWN, "Unknown error in worker thread");
+			NextJob = JobCount;
+		}
+	}
+	if (--Busy == 0)
+		WorkDone.Broadcast();
+}
+
+void FFThreadPool::Run(JobFunc Job, void *Arg, int Count) {
+	if (Count <= 0)
+		return;
+
+	Lock.Lock();
+	this->Job = Job;
+	this->Arg = Arg;
+	NextJob = 0;
+	JobCount = Count;
+	Generation++;
+	if (Count > 1)
+		WorkAvailable.Broadcast();
+
+	RunJobs();
+	while (Busy > 0)
+		WorkDone.Wait(Lock);
+
+	FFMS_Exception *E = Error;
+	Error = NULL;
+	Lock.Unlock();
+
+	if (E) {
+		FFMS_Exception Copy(*E);
+		delete E;
+		throw Copy;
+	}
+}
@@ -0,0 +1,116 @@
+//  Copyright (c) 2012 Fredrik Mellbin
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#ifndef THREADING_H
+#define THREADING_H
+
+#include "utils.h"
+
+class FFCondition;
+
+class FFMutex {
+private:
+	friend class FFCondition;
+	void *Handle;
+	FFMutex(const FFMutex &);
+	FFMutex &operator=(const FFMutex &);
+public:
+	FFMutex();
+	~FFMutex();
+	void Lock();
+	void Unlock();
+};
+
+class FFScopedLock {
+private:
+	FFMutex &Mutex;
+	FFScopedLock(const FFScopedLock &);
+	FFScopedLock &operator=(const FFScopedLock &);
+public:
+	explicit FFScopedLock(FFMutex &Mutex) : Mutex(Mutex) { Mutex.Lock(); }
+	~FFScopedLock() { Mutex.Unlock(); }
+};
+
+// Uses the native condition variables on Vista and later, and an
+// emulation built from a semaphore and an event when the build targets
+// older Windows (_WIN32_WINNT below 0x0600)
+class FFCondition {
+private:
+	void *Handle;
+	FFCondition(const FFCondition &);
+	FFCondition &operator=(const FFCondition &);
+public:
+	FFCondition();
+	~FFCondition();
+	// Mutex must be locked by the calling thread
+	void Wait(FFMutex &Mutex);
+	void Signal();
+	void Broadcast();
+};
+
+// Runs Func(Arg) on a new thread, the destructor waits for it to return
+class FFThread {
+private:
+	void *Handle;
+	unsigned Id;
+	FFThread(const FFThread &);
+	FFThread &operator=(const FFThread &);
+public:
+	FFThread(void (*Func)(void *), void *Arg);
+	~FFThread();
+	// True when called from the thread itself, which can't wait for itself
+	bool IsCurrent() const;
+};
+
+// A fixed set of worker threads for splitting work into independent jobs
+class FFThreadPool {
+public:
+	typedef void (*JobFunc)(void *Arg, int Index);
+private:
+	std::vector<FFThread *> Workers;
+	FFMutex Lock;
+	FFCondition WorkAvailable;
+	FFCondition WorkDone;
+	JobFunc Job;
+	void *Arg;
+	int NextJob;
+	int JobCount;
+	int Busy;
+	unsigned Generation;
+	bool Quit;
+	FFMS_Exception *Error;
+
+	static void WorkerMain(void *Pool);
+	void RunJobs();
+	void Stop();
+	FFThreadPool(const FFThreadPool &);
+	FFThreadPool &operator=(const FFThreadPool &);
+public:
+	// Threads includes the thread calling Run()
+	explicit FFThreadPool(int Threads);
+	~FFThreadPool();
+	int GetThreads() const { return static_cast<int>(Workers.size()) + 1; }
+	// Calls Job(Arg, i) for every i in [0, Count) and returns once all of them have finished.
+	// Jobs may run in any order and on any thread. The first exception thrown by a job is
+	// rethrown here and the jobs that haven't started yet are skipped.
+	void Run(JobFunc Job, void *Arg, int Count);
+};
+
+#endif
@@ -546,11 +546,37 @@ CComPtr<IMMContainer> HaaliOpenFile(const char *SourceFile, FFMS_Sources SourceM
 
 #endif
 
-void LAVFOpenFile(const char *SourceFile, AVFormatContext *&FormatContext) {
+// The header has to have produced the same streams the indexer saw for the
+// stored parameters to be usable, otherwise the file is probed as usual
+static bool ApplyIndexCodecParams(AVFormatContext *FormatContext, const FFMS_Index *Index) {
+	if (!Index || Index->Decoder != FFMS_SOURCE_LAVF || Index->size() != FormatContext->nb_streams)
+		return false;
+
+	for (unsigned int i = 0; i < FormatContext->nb_streams; i++) {
+		const TCodecParams &CP = (*Index)[i].CodecParams;
+		if (!CP.Valid || CP.Codec != FormatContext->streams[i]->codec->codec_id)
+			return false;
+	}
+
+	for (unsigned int i = 0; i < FormatContext->nb_streams; i++)
+		(*Index)[i].CodecParams.Apply(FormatContext->streams[i]);
+	return true;
+}
+
+void LAVFOpenFile(const char *SourceFile, AVFormatContext *&FormatContext, const FFMS_Index *Index) {
 	if (avformat_open_input(&FormatContext, SourceFile, NULL, NULL) != 0)
 		throw FFMS_Exception(FFMS_ERROR_PARSER, FFMS_ERROR_FILE_READ,
 			std::string("Couldn't open '") + SourceFile + "'");
 
+	try {
+		if (ApplyIndexCodecParams(FormatContext, Index))
+			return;
+	} catch (...) {
+		avformat_close_input(&FormatContext);
+		FormatContext = NULL;
+		throw;
+	}
+
 	if (avformat_find_stream_info(FormatContext,NULL) < 0) {
 		avformat_close_input(&FormatContext);
 		FormatContext = NULL;
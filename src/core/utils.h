@@ -230,7 +230,7 @@ void ffms_patch_lavf_file_open();
 #ifdef HAALISOURCE
 CComPtr<IMMContainer> HaaliOpenFile(const char *SourceFile, FFMS_Sources SourceMode);
 #endif // HAALISOURCE
-void LAVFOpenFile(const char *SourceFile, AVFormatContext *&FormatContext);
+void LAVFOpenFile(const char *SourceFile, AVFormatContext *&FormatContext, const FFMS_Index *Index = NULL);
 
 void FlushBuffers(AVCodecContext *CodecContext);
 
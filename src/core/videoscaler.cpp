@@ -0,0 +1,185 @@
+//  Copyright (c) 2012 Fredrik Mellbin
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+#include "videosource.h"
+#include "bufferpool.h"
+
+extern "C" {
+#include <libavutil/imgutils.h>
+}
+
+bool ScalerSettings::operator==(const ScalerSettings &Other) const {
+	return SrcW == Other.SrcW && SrcH == Other.SrcH && SrcFormat == Other.SrcFormat &&
+		SrcColorSpace == Other.SrcColorSpace && SrcColorRange == Other.SrcColorRange &&
+		DstW == Other.DstW && DstH == Other.DstH && DstFormat == Other.DstFormat &&
+		DstColorSpace == Other.DstColorSpace && DstColorRange == Other.DstColorRange &&
+		Flags == Other.Flags;
+}
+
+ScalerCache::ScalerCache(size_t MaxScalers)
+: MaxScalers(MaxScalers)
+{
+}
+
+ScalerCache::~ScalerCache() {
+	Clear();
+}
+
+ScalerCache::Scaler *ScalerCache::Get(const ScalerSettings &Settings, int Bands) {
+	for (std::list<Scaler>::iterator It = Scalers.begin(); It != Scalers.end(); ++It) {
+		if (It->Settings == Settings) {
+			Scalers.splice(Scalers.begin(), Scalers, It);
+			return &Scalers.front();
+		}
+	}
+
+	Scaler New;
+	New.Settings = Settings;
+	New.Context = NULL;
+	New.Convert = NULL;
+	if (Settings.SrcW == Settings.DstW && Settings.SrcH == Settings.DstH &&
+		Settings.SrcColorSpace == Settings.DstColorSpace && Settings.SrcColorRange == Settings.DstColorRange)
+		New.Convert = GetFastConverter(Settings.SrcFormat, Settings.DstFormat, Settings.SrcW, Settings.SrcH);
+
+	// Repacking the planes is limited by memory bandwidth, not worth splitting,
+	// and doesn't need swscale at all
+	if (New.Convert) {
+		Bands = 1;
+	} else {
+		New.Context = GetSwsContext(
+			Settings.SrcW, Settings.SrcH, Settings.SrcFormat, Settings.SrcColorSpace, Settings.SrcColorRange,
+			Settings.DstW, Settings.DstH, Settings.DstFormat, Settings.DstColorSpace, Settings.DstColorRange,
+			Settings.Flags);
+		if (!New.Context)
+			return NULL;
+	}
+	if (PoolPictureAlloc(&New.Frame, Settings.DstFormat, Settings.DstW, Settings.DstH) < 0) {
+		sws_freeContext(New.Context);
+		return NULL;
+	}
+
+	// Band edges are kept on multiples of SCALE_BAND_ALIGNMENT rows so that
+	// they fall on whole chroma rows and the dither pattern lines up
+	for (int i = 0; Bands > 1 && i < Bands; i++) {
+		int Top = (Settings.SrcH * i / Bands) & ~(SCALE_BAND_ALIGNMENT - 1);
+		int Bottom = (i == Bands - 1) ? Settings.SrcH : (Settings.SrcH * (i + 1) / Bands) & ~(SCALE_BAND_ALIGNMENT - 1);
+
+		Band B;
+		B.Start = FFMAX(0, Top - SCALE_BAND_MARGIN);
+		B.Rows = FFMIN(Settings.SrcH, Bottom + SCALE_BAND_MARGIN) - B.Start;
+		B.Skip = Top - B.Start;
+		B.Height = Bottom - Top;
+		B.Context = GetSwsContext(
+			Settings.SrcW, B.Rows, Settings.SrcFormat, Settings.SrcColorSpace, Settings.SrcColorRange,
+			Settings.DstW, B.Rows, Settings.DstFormat, Settings.DstColorSpace, Settings.DstColorRange,
+			Settings.Flags);
+		if (B.Context && PoolPictureAlloc(&B.Frame, Settings.DstFormat, Settings.DstW, B.Rows) < 0) {
+			sws_freeContext(B.Context);
+			B.Context = NULL;
+		}
+
+		// Converting the whole picture on one thread still works
+		if (!B.Context) {
+			FreeBands(New);
+			break;
+		}
+		New.Bands.push_back(B);
+	}
+
+	while (Scalers.size() >= MaxScalers) {
+		Free(Scalers.back());
+		Scalers.pop_back();
+	}
+
+	Scalers.push_front(New);
+	return &Scalers.front();
+}
+
+void ScalerCache::FreeBands(Scaler &S) {
+	for (size_t i = 0; i < S.Bands.size(); i++) {
+		sws_freeContext(S.Bands[i].Context);
+		PoolPictureFree(&S.Bands[i].Frame);
+	}
+	S.Bands.clear();
+}
+
+void ScalerCache::Free(Scaler &S) {
+	FreeBands(S);
+	sws_freeContext(S.Context);
+	PoolPictureFree(&S.Frame);
+}
+
+void ScalerCache::Clear() {
+	for (std::list<Scaler>::iterator It = Scalers.begin(); It != Scalers.end(); ++It)
+		Free(*It);
+	Scalers.clear();
+}
+
+struct ScaleJob {
+	ScalerCache::Scaler *Scaler;
+	const uint8_t *const *Data;
+	const int *Linesize;
+	uint8_t *const *DstData;
+	const int *DstLinesize;
+};
+
+static void ScaleBandJob(void *Arg, int Index) {
+	ScaleJob *Job = static_cast<ScaleJob *>(Arg);
+	const ScalerSettings &Settings = Job->Scaler->Settings;
+	ScalerCache::Band &Band = Job->Scaler->Bands[Index];
+
+	const uint8_t *Src[4] = {};
+	int SrcStride[4] = {};
+	for (int i = 0; i < CountPlanes(Settings.SrcFormat); i++) {
+		Src[i] = Job->Data[i] + (Band.Start >> PlaneShift(Settings.SrcFormat, i)) * Job->Linesize[i];
+		SrcStride[i] = Job->Linesize[i];
+	}
+	sws_scale(Band.Context, Src, SrcStride, 0, Band.Rows, Band.Frame.data, Band.Frame.linesize);
+
+	// Both pictures have the same format and width, so the rows are
+	// Band.Frame.linesize bytes long and the planes can be copied in one go
+	// unless the destination is a caller's buffer with a different stride
+	for (int i = 0; i < CountPlanes(Settings.DstFormat); i++) {
+		int Shift = PlaneShift(Settings.DstFormat, i);
+		int First = Band.Skip >> Shift;
+		int Last = (Band.Skip + Band.Height + (1 << Shift) - 1) >> Shift;
+		uint8_t *Dst = Job->DstData[i] + ((Band.Start + Band.Skip) >> Shift) * Job->DstLinesize[i];
+		const uint8_t *Src = Band.Frame.data[i] + First * Band.Frame.linesize[i];
+		if (Job->DstLinesize[i] == Band.Frame.linesize[i])
+			memcpy(Dst, Src, (Last - First) * Band.Frame.linesize[i]);
+		else
+			av_image_copy_plane(Dst, Job->DstLinesize[i], Src, Band.Frame.linesize[i], Band.Frame.linesize[i], Last - First);
+	}
+}
+
+void FFMS_VideoSource::ScaleFrame(ScalerCache::Scaler *Scaler, const uint8_t *const *Data, const int *Linesize, uint8_t *const *DstData, const int *DstLinesize) {
+	if (Scaler->Convert) {
+		Scaler->Convert(Data, Linesize, DstData, DstLinesize, Scaler->Settings.SrcW, Scaler->Settings.SrcH);
+		return;
+	}
+
+	if (Scaler->Bands.empty() || !ScalePool.get()) {
+		sws_scale(Scaler->Context, Data, Linesize, 0, Scaler->Settings.SrcH, DstData, DstLinesize);
+		return;
+	}
+
+	ScaleJob Job = { Scaler, Data, Linesize, DstData, DstLinesize };
+	ScalePool->Run(ScaleBandJob, &Job, static_cast<int>(Scaler->Bands.size()));
+}
@@ -20,15 +20,93 @@
 
 #include "videosource.h"
 #include "numthreads.h"
+#include "bufferpool.h"
+
+extern "C" {
+#include <libavutil/imgutils.h>
+}
+
+#define PP_BAND_MARGIN 32
+#define MIN_PP_BAND_HEIGHT 128
+#define DEFAULT_FRAME_REF_LIMIT 32
+
+void FFMS_VideoSource::Open() {
+	if (Opened)
+		return;
+	if (OpenError.get())
+		throw *OpenError;
+
+	// Set first so nothing OpenDecoder does can end up here again
+	Opened = true;
+	try {
+		OpenDecoder();
+	} catch (FFMS_Exception &e) {
+		Opened = false;
+		OpenError.reset(new FFMS_Exception(e));
+		throw;
+	}
+}
+
+const FFMS_VideoProperties& FFMS_VideoSource::GetVideoProperties() {
+	// Until the source is opened this is what SetIndexVideoProperties found
+	return VP;
+}
+
+void FFMS_VideoSource::SetIndexVideoProperties() {
+	const TCodecParams &CP = Frames.CodecParams;
+
+	VP.FPSDenominator = CP.StreamTimeBase.num;
+	VP.FPSNumerator = CP.StreamTimeBase.den;
+
+	// sanity check framerate
+	if (VP.FPSDenominator > VP.FPSNumerator || VP.FPSDenominator <= 0 || VP.FPSNumerator <= 0) {
+		VP.FPSDenominator = 1;
+		VP.FPSNumerator = 30;
+	}
+
+	// Calculate the average framerate
+	if (Frames.size() >= 2) {
+		double PTSDiff = (double)(Frames.back().PTS - Frames.front().PTS);
+		double TD = (double)(Frames.TB.Den);
+		double TN = (double)(Frames.TB.Num);
+		VP.FPSDenominator = (unsigned int)(((double)1000000) / (double)((Frames.size() - 1) / ((PTSDiff * TN/TD) / (double)1000)));
+		VP.FPSNumerator = 1000000;
+	}
+	CorrectNTSCRationalFramerate(&VP.FPSNumerator, &VP.FPSDenominator);
+
+	VP.RFFDenominator = CP.CodecTimeBase.num;
+	VP.RFFNumerator = CP.CodecTimeBase.den;
+	if (CP.Codec == CODEC_ID_H264) {
+		if (VP.RFFNumerator & 1)
+			VP.RFFDenominator *= 2;
+		else
+			VP.RFFNumerator /= 2;
+	}
+
+	VP.SARNum = CP.SampleAspectRatio.num;
+	VP.SARDen = CP.SampleAspectRatio.den;
+
+	VP.EncodedWidth = CP.Width;
+	VP.EncodedHeight = CP.Height;
+	VP.EncodedPixelFormat = CP.PixFmt;
+
+	// The preview settings make the decoder output a smaller picture
+	AVCodec *Codec = avcodec_find_decoder(static_cast<CodecID>(CP.Codec));
+	if (Preview && Codec && Codec->max_lowres > 0) {
+		VP.EncodedWidth = -((-VP.EncodedWidth) >> 1);
+		VP.EncodedHeight = -((-VP.EncodedHeight) >> 1);
+	}
+}
 
 void FFMS_VideoSource::GetFrameCheck(int n) {
+	Open();
 	if (n < 0 || n >= VP.NumFrames)
 		throw FFMS_Exception(FFMS_ERROR_DECODING, FFMS_ERROR_INVALID_ARGUMENT,
 			"Out of bounds frame requested");
 }
 
 void FFMS_VideoSource::SetPP(const char *PP) {
-
+	Open();
 #ifdef FFMS_USE_POSTPROC
 	if (PPMode)
 		pp_free_mode(PPMode);
@@ -48,6 +126,7 @@ void FFMS_VideoSource::SetPP(const char *PP) {
 		}
 		
 	}
+	PPString = PP ? PP : "";
 
 	ReAdjustPP(CodecContext->pix_fmt, CodecContext->width, CodecContext->height);
 	OutputFrame(DecodeFrame);
@@ -58,7 +137,10 @@ void FFMS_VideoSource::SetPP(const char *PP) {
 }
 
 void FFMS_VideoSource::ResetPP() {
+	Open();
 #ifdef FFMS_USE_POSTPROC
+	FreePPBands();
+
 	if (PPContext)
 		pp_free_context(PPContext);
 	PPContext = NULL;
@@ -68,11 +150,42 @@ void FFMS_VideoSource::ResetPP() {
 	PPMode = NULL;
 
 #endif /* FFMS_USE_POSTPROC */
+	PPString.clear();
 	OutputFrame(DecodeFrame);
 }
 
+#ifdef FFMS_USE_POSTPROC
+// Autolevels uses the histogram of the whole picture and the temporal
+// noise reducer keeps state from earlier frames, so neither gives the same
+// result when the picture is processed in parts
+static bool PPNeedsWholeFrame(const std::string &PP) {
+	size_t Pos = 0;
+	while (Pos < PP.size()) {
+		size_t End = PP.find_first_of(",/", Pos);
+		if (End == std::string::npos)
+			End = PP.size();
+		// Options follow the name after a ':', disabled filters start with '-'
+		std::string Name = PP.substr(Pos, FFMIN(PP.find(':', Pos), End) - Pos);
+		if (Name == "al" || Name == "autolevels" || Name == "tn" || Name == "tmpnoise")
+			return true;
+		Pos = End + 1;
+	}
+	return false;
+}
+
+void FFMS_VideoSource::FreePPBands() {
+	for (size_t i = 0; i < PPBands.size(); i++) {
+		pp_free_context(PPBands[i].Context);
+		PoolPictureFree(&PPBands[i].Frame);
+	}
+	PPBands.clear();
+}
+#endif // FFMS_USE_POSTPROC
+
 void FFMS_VideoSource::ReAdjustPP(PixelFormat VPixelFormat, int Width, int Height) {
 #ifdef FFMS_USE_POSTPROC
+	FreePPBands();
+
 	if (PPContext)
 		pp_free_context(PPContext);
 	PPContext = NULL;
@@ -102,8 +215,47 @@ void FFMS_VideoSource::ReAdjustPP(PixelFormat VPixelFormat, int Width, int Heigh
 
 	PPContext = pp_get_context(Width, Height, Flags);
 
-	avpicture_free(&PPFrame);
-	avpicture_alloc(&PPFrame, VPixelFormat, Width, Height);
+	PoolPictureFree(&PPFrame);
+	PoolPictureAlloc(&PPFrame, VPixelFormat, Width, Height);
+
+	// The filters work on 8x8 blocks with the quantizers of whole
+	// macroblocks, so band edges are kept on macroblock rows and the
+	// margins are wide enough that the filters at the edge of a band
+	// never reach the rows that are copied out of it
+	int Bands = FFMIN(DecodingThreads, Height / MIN_PP_BAND_HEIGHT);
+	if (Bands < 2 || PPNeedsWholeFrame(PPString))
+		return;
+
+	if (!ScalePool.get()) {
+		try {
+			ScalePool.reset(new FFThreadPool(DecodingThreads));
+		} catch (FFMS_Exception &) {
+			return;
+		}
+	}
+
+	for (int i = 0; i < Bands; i++) {
+		int Top = (Height * i / Bands) & ~(SCALE_BAND_ALIGNMENT - 1);
+		int Bottom = (i == Bands - 1) ? Height : (Height * (i + 1) / Bands) & ~(SCALE_BAND_ALIGNMENT - 1);
+
+		PPBand B;
+		B.Start = FFMAX(0, Top - PP_BAND_MARGIN);
+		B.Rows = FFMIN(Height, Bottom + PP_BAND_MARGIN) - B.Start;
+		B.Skip = Top - B.Start;
+		B.Height = Bottom - Top;
+		B.Context = pp_get_context(Width, B.Rows, Flags);
+		if (B.Context && PoolPictureAlloc(&B.Frame, VPixelFormat, Width, B.Rows) < 0) {
+			pp_free_context(B.Context);
+			B.Context = NULL;
+		}
+
+		// Postprocessing the whole picture on one thread still works
+		if (!B.Context) {
+			FreePPBands();
+			return;
+		}
+		PPBands.push_back(B);
+	}
 #else
 	return;
 #endif /* FFMS_USE_POSTPROC */
@@ -119,6 +271,20 @@ static void CopyAVPictureFields(AVPicture &Picture, FFMS_Frame &Dst) {
 }
 
 
+// Where the pixel at Left, Top is relative to the start of the plane
+static int PlaneOffset(PixelFormat Format, int Plane, int Left, int Top, int Linesize) {
+	const AVPixFmtDescriptor &Desc = av_pix_fmt_descriptors[Format];
+	int Step = 1;
+	for (int i = 0; i < Desc.nb_components; i++) {
+		if (Desc.comp[i].plane == Plane) {
+			Step = Desc.comp[i].step_minus1 + 1;
+			break;
+		}
+	}
+	int ShiftW = (Plane == 1 || Plane == 2) ? Desc.log2_chroma_w : 0;
+	return (Top >> PlaneShift(Format, Plane)) * Linesize + (Left >> ShiftW) * Step;
+}
+
 // this might look stupid, but we have actually had crashes caused by not checking like this.
 static void SanityCheckFrameForData(AVFrame *Frame) {
 	for (int i = 0; i < 4; i++) {
@@ -132,6 +298,7 @@ static void SanityCheckFrameForData(AVFrame *Frame) {
 
 FFMS_Frame *FFMS_VideoSource::OutputFrame(AVFrame *Frame) {
 	SanityCheckFrameForData(Frame);
+	LastOutputFrame = NULL;
 
 	if (LastFrameWidth != CodecContext->width || LastFrameHeight != CodecContext->height || LastFramePixelFormat != CodecContext->pix_fmt) {
 		ReAdjustPP(CodecContext->pix_fmt, CodecContext->width, CodecContext->height);
@@ -147,45 +314,79 @@ FFMS_Frame *FFMS_VideoSource::OutputFrame(AVFrame *Frame) {
 		}
 	}
 
+	AVPicture Source;
+	memset(&Source, 0, sizeof(Source));
+	for (int i = 0; i < 4; i++) {
+		Source.data[i] = Frame->data[i];
+		Source.linesize[i] = Frame->linesize[i];
+	}
+
 #ifdef FFMS_USE_POSTPROC
 	if (PPMode) {
-		pp_postprocess(const_cast<const uint8_t **>(Frame->data), Frame->linesize, PPFrame.data, PPFrame.linesize, CodecContext->width, CodecContext->height, Frame->qscale_table, Frame->qstride, PPMode, PPContext, Frame->pict_type | (Frame->qscale_type ? PP_PICT_TYPE_QP2 : 0));
-		if (SWS) {
-			sws_scale(SWS, PPFrame.data, PPFrame.linesize, 0, CodecContext->height, SWSFrame.data, SWSFrame.linesize);
-			CopyAVPictureFields(SWSFrame, LocalFrame);
-		} else {
-			CopyAVPictureFields(PPFrame, LocalFrame);
-		}
-	} else {
-		if (SWS) {
-			sws_scale(SWS, Frame->data, Frame->linesize, 0, CodecContext->height, SWSFrame.data, SWSFrame.linesize);
-			CopyAVPictureFields(SWSFrame, LocalFrame);
-		} else {
-			// Special case to avoid ugly casts
-			for (int i = 0; i < 4; i++) {
-				LocalFrame.Data[i] = Frame->data[i];
-				LocalFrame.Linesize[i] = Frame->linesize[i];
-			}
+		PostProcess(Frame);
+		Source = PPFrame;
+	}
+#endif // FFMS_USE_POSTPROC
+
+	// Cropping is only a matter of where the planes start
+	int Left, Top, Width, Height;
+	GetCropRect(Left, Top, Width, Height);
+	for (int i = 0; i < CountPlanes(CodecContext->pix_fmt); i++)
+		Source.data[i] += PlaneOffset(CodecContext->pix_fmt, i, Left, Top, Source.linesize[i]);
+
+	// A field is every other row of the picture, so it can be converted
+	// straight from the decoded frame by doubling the line sizes
+	if (TargetField != FFMS_FIELD_NONE) {
+		int Rows = 2 << av_pix_fmt_descriptors[CodecContext->pix_fmt].log2_chroma_h;
+		if (Top % Rows || Height % Rows || (TargetHeight > 0 && TargetHeight % 2))
+			throw FFMS_Exception(FFMS_ERROR_DECODING, FFMS_ERROR_UNSUPPORTED,
+				"The frame height can't be split into fields");
+
+		for (int i = 0; i < CountPlanes(CodecContext->pix_fmt); i++) {
+			if (TargetField == FFMS_FIELD_BOTTOM)
+				Source.data[i] += Source.linesize[i];
+			Source.linesize[i] *= 2;
 		}
+		Height /= 2;
 	}
-#else // FFMS_USE_POSTPROC
-	if (SWS) {
-		sws_scale(SWS, Frame->data, Frame->linesize, 0, CodecContext->height, SWSFrame.data, SWSFrame.linesize);
-		CopyAVPictureFields(SWSFrame, LocalFrame);
-	} else {
-		// Special case to avoid ugly casts
+
+	bool Direct = DirectData != NULL && TargetField == FFMS_FIELD_NONE;
+	if (Direct && DirectFormat != PIX_FMT_NONE) {
+		PixelFormat Format;
+		int OutputWidth, OutputHeight;
+		GetOutputSize(Format, OutputWidth, OutputHeight);
+		Direct = Format == DirectFormat && OutputWidth == DirectWidth && OutputHeight == DirectHeight;
+	}
+
+	if (Direct) {
+		AVPicture Target;
 		for (int i = 0; i < 4; i++) {
-			LocalFrame.Data[i] = Frame->data[i];
-			LocalFrame.Linesize[i] = Frame->linesize[i];
+			Target.data[i] = DirectData[i];
+			Target.linesize[i] = DirectLinesize[i];
 		}
+
+		if (CurrentScaler)
+			ScaleFrame(CurrentScaler, Source.data, Source.linesize, Target.data, Target.linesize);
+		else
+			av_image_copy(Target.data, Target.linesize, const_cast<const uint8_t **>(Source.data), Source.linesize, CodecContext->pix_fmt, Width, Height);
+		CopyAVPictureFields(Target, LocalFrame);
+	} else if (CurrentScaler && TargetField != FFMS_FIELD_NONE) {
+		ScalerCache::Scaler *Scaler = GetFieldScaler();
+		ScaleFrame(Scaler, Source.data, Source.linesize, Scaler->Frame.data, Scaler->Frame.linesize);
+		CopyAVPictureFields(Scaler->Frame, LocalFrame);
+	} else if (CurrentScaler && !DeferScaling) {
+		ScaleFrame(CurrentScaler, Source.data, Source.linesize, SWSFrame.data, SWSFrame.linesize);
+		CopyAVPictureFields(SWSFrame, LocalFrame);
+	} else {
+		CopyAVPictureFields(Source, LocalFrame);
 	}
-#endif // FFMS_USE_POSTPROC
+	LocalFrameDirect = Direct;
 
-	LocalFrame.EncodedWidth = CodecContext->width;
-	LocalFrame.EncodedHeight = CodecContext->height;
+	LocalFrame.EncodedWidth = Width;
+	LocalFrame.EncodedHeight = Height;
 	LocalFrame.EncodedPixelFormat = CodecContext->pix_fmt;
 	LocalFrame.ScaledWidth = TargetWidth;
-	LocalFrame.ScaledHeight = TargetHeight;
+	LocalFrame.ScaledHeight = (TargetField != FFMS_FIELD_NONE && TargetHeight > 0) ? TargetHeight / 2 : TargetHeight;
 	LocalFrame.ConvertedPixelFormat = OutputFormat;
 	LocalFrame.KeyFrame = Frame->key_frame;
 	LocalFrame.PictType = av_get_picture_type_char(Frame->pict_type);
@@ -194,16 +395,63 @@ FFMS_Frame *FFMS_VideoSource::OutputFrame(AVFrame *Frame) {
 	LocalFrame.TopFieldFirst = Frame->top_field_first;
 	LocalFrame.ColorSpace = OutputColorSpace;
 	LocalFrame.ColorRange = OutputColorRange;
+	LocalFrame.Preview = Preview;
+	LocalFrame.Field = TargetField;
 
 	LastFrameHeight = CodecContext->height;
 	LastFrameWidth = CodecContext->width;
 	LastFramePixelFormat = CodecContext->pix_fmt;
 
+	// The extra outputs stay at the last whole frame
+	if (!ExtraOutputs.empty() && TargetField == FFMS_FIELD_NONE)
+		OutputExtraFrames(Source);
+
+	LastOutputFrame = Frame;
+	LastOutputPicture = DecodedPictures;
+	for (int i = 0; i < 4; i++)
+		LastOutputData[i] = Frame->data[i];
+	LastOutputPictType = Frame->pict_type;
+	LastOutputRepeatPict = Frame->repeat_pict;
+#if LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(52, 94, 3)
+	LastOutputPTS = Frame->pkt_pts;
+#endif
 	return &LocalFrame;
 }
 
-FFMS_VideoSource::FFMS_VideoSource(const char *SourceFile, FFMS_Index &Index, int Track, int Threads)
-: Index(Index)
+// Decoders that repeat a picture, for example for skipped frames, output
+// the same buffer again. A buffer the decoder recycles for a new picture
+// has the timestamp of the new picture's packet, and without timestamps
+// nothing is assumed to be repeated.
+bool FFMS_VideoSource::SameDecoderOutput() const {
+#if LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(52, 94, 3)
+	if (DecodeFrame->pkt_pts == AV_NOPTS_VALUE || DecodeFrame->pkt_pts != LastOutputPTS)
+		return false;
+	for (int i = 0; i < 4; i++)
+		if (DecodeFrame->data[i] != LastOutputData[i])
+			return false;
+	return DecodeFrame->pict_type == LastOutputPictType && DecodeFrame->repeat_pict == LastOutputRepeatPict;
+#else
+	return false;
+#endif
+}
+
+// Near the end of the stream there may be nothing left to output, and some
+// decoders output the previous picture again, in which case it doesn't have
+// to be converted again
+FFMS_Frame *FFMS_VideoSource::OutputDecodeFrame() {
+	// GetCachedFrame outputs the frame from the reverse buffer instead
+	if (FillingReverseBuffer)
+		return NULL;
+	if (LastOutputFrame == DecodeFrame && (LastOutputPicture == DecodedPictures || SameDecoderOutput()) &&
+		!DirectData && !LocalFrameDirect && LocalFrame.Field == TargetField)
+		return &LocalFrame;
+	return OutputFrame(DecodeFrame);
+}
+
+FFMS_VideoSource::FFMS_VideoSource(const char *SourceFile, FFMS_Index &Index, int Track, int Threads, int Flags)
+: Scalers(SCALER_CACHE_SIZE)
+, FieldScalers(FIELD_SCALER_CACHE_SIZE)
+, Index(Index)
 , CodecContext(NULL)
 {
 	if (Track < 0 || Track >= static_cast<int>(Index.size()))
@@ -218,6 +466,11 @@ FFMS_VideoSource::FFMS_VideoSource(const char *SourceFile, FFMS_Index &Index, in
 		throw FFMS_Exception(FFMS_ERROR_INDEX, FFMS_ERROR_INVALID_ARGUMENT,
 			"Video track contains no frames");
 
+	// The properties have to come from somewhere when nothing is opened
+	if ((Flags & FFMS_VSF_LAZY) && !Index[Track].CodecParams.Valid)
+		throw FFMS_Exception(FFMS_ERROR_INDEX, FFMS_ERROR_UNSUPPORTED,
+			"Lazy opening needs the codec parameters in the index, which only libavformat indexes have");
+
 	if (!Index.CompareFileSignature(SourceFile))
 		throw FFMS_Exception(FFMS_ERROR_INDEX, FFMS_ERROR_FILE_MISMATCH,
 			"The index does not match the source file");
@@ -225,17 +478,64 @@ FFMS_VideoSource::FFMS_VideoSource(const char *SourceFile, FFMS_Index &Index, in
 	Frames = Index[Track];
 	VideoTrack = Track;
 
+	// Every frame of an all-intra track can be decoded on its own
+	AllIntra = Frames.size() > 1;
+	for (size_t i = 0; AllIntra && i < Frames.size(); i++)
+		AllIntra = !!Frames[i].KeyFrame;
+
 	memset(&VP, 0, sizeof(VP));
+	// Known without opening anything, the rest is filled in by OpenDecoder
+	VP.NumFrames = Frames.size();
+	VP.FirstTime = ((Frames.front().PTS * Frames.TB.Num) / (double)Frames.TB.Den) / 1000;
+	VP.LastTime = ((Frames.back().PTS * Frames.TB.Num) / (double)Frames.TB.Den) / 1000;
+	Opened = false;
+	Preview = !!(Flags & FFMS_VSF_PREVIEW);
+	if (Flags & FFMS_VSF_LAZY)
+		SetIndexVideoProperties();
 #ifdef FFMS_USE_POSTPROC
 	PPContext = NULL;
 	PPMode = NULL;
 #endif // FFMS_USE_POSTPROC
-	SWS = NULL;
+	CurrentScaler = NULL;
+	memset(&SWSFrame, 0, sizeof(SWSFrame));
 	LastFrameNum = 0;
+	DecodedPictures = 0;
+	LastOutputFrame = NULL;
+	LastOutputPicture = 0;
+	memset(LastOutputData, 0, sizeof(LastOutputData));
+	LastOutputPictType = 0;
+	LastOutputRepeatPict = 0;
+	LastOutputPTS = AV_NOPTS_VALUE;
 	CurrentFrame = 1;
 	DelayCounter = 0;
 	InitialDecode = 1;
 	CodecContext = NULL;
+	SourceFlags = Flags;
+	Refining = NULL;
+	ReverseBufferStart = 0;
+	LastRequested = -1;
+	FillingReverseBuffer = false;
+	FirstNeeded = 0;
+	AnchorInterval = 0;
+	MaxAnchorSize = 0;
+	ExactDecode = false;
+	LastAnchorPicture = 0;
+	DirectData = NULL;
+	DirectLinesize = NULL;
+	DirectFormat = PIX_FMT_NONE;
+	DirectWidth = 0;
+	DirectHeight = 0;
+	LocalFrameDirect = false;
+	TargetField = FFMS_FIELD_NONE;
+	LocalFrame.Field = FFMS_FIELD_NONE;
+	DeferScaling = false;
+	FrameRefLimit = DEFAULT_FRAME_REF_LIMIT;
+
+	CropLeft = 0;
+	CropTop = 0;
+	CropRight = 0;
+	CropBottom = 0;
+	AnchorSize = 0;
 
 	LastFrameHeight = -1;
 	LastFrameWidth = -1;
@@ -262,38 +562,305 @@ FFMS_VideoSource::FFMS_VideoSource(const char *SourceFile, FFMS_Index &Index, in
 
 	// Dummy allocations so the unallocated case doesn't have to be handled later
 #ifdef FFMS_USE_POSTPROC
-	avpicture_alloc(&PPFrame, PIX_FMT_GRAY8, 16, 16);
+	PoolPictureAlloc(&PPFrame, PIX_FMT_GRAY8, 16, 16);
 #endif // FFMS_USE_POSTPROC
-	avpicture_alloc(&SWSFrame, PIX_FMT_GRAY8, 16, 16);
 
 	Index.AddRef();
 }
 
+void FFMS_VideoSource::SetDecoderOptions(AVCodecContext *Context, AVCodec *Codec) {
+	if (!Preview || !Codec)
+		return;
+
+	// Trade quality for speed everywhere the decoder lets us
+	Context->lowres = FFMIN(1, Codec->max_lowres);
+	Context->skip_loop_filter = AVDISCARD_ALL;
+	Context->skip_idct = AVDISCARD_NONREF;
+	Context->flags2 |= CODEC_FLAG2_FAST;
+}
+
 FFMS_VideoSource::~FFMS_VideoSource() {
+	DetachFrameRefs();
+	Refiner.reset();
+	Pipeline.reset();
+	ResetExtraOutputs();
+	FreeIntraDecoders();
+	ClearReverseBuffer();
+	ClearAnchors();
+
 #ifdef FFMS_USE_POSTPROC
+	FreePPBands();
+
 	if (PPMode)
 		pp_free_mode(PPMode);
 
 	if (PPContext)
 		pp_free_context(PPContext);
 
-	avpicture_free(&PPFrame);
+	PoolPictureFree(&PPFrame);
 #endif // FFMS_USE_POSTPROC
 
-	if (SWS)
-		sws_freeContext(SWS);
-
-	avpicture_free(&SWSFrame);
 	av_freep(&DecodeFrame);
 
 	Index.Release();
 }
 
+FFMS_Frame *FFMS_VideoSource::GetFrameInto(int n, uint8_t *const *Data, const int *Linesize, PixelFormat Format, int Width, int Height) {
+	GetFrameCheck(n);
+
+	PixelFormat OutputFormat;
+	int OutputWidth, OutputHeight;
+	GetOutputSize(OutputFormat, OutputWidth, OutputHeight);
+	if (Format != OutputFormat || Width != OutputWidth || Height != OutputHeight)
+		throw FFMS_Exception(FFMS_ERROR_DECODING, FFMS_ERROR_INVALID_ARGUMENT,
+			"The buffer doesn't match the format and size of the output frames");
+
+	// The frame itself can still turn out to have a different size, in which
+	// case it isn't written to the buffer either
+	GetFrameDirect(n, Data, Linesize, Format, Width, Height);
+	if (!LocalFrameDirect)
+		throw FFMS_Exception(FFMS_ERROR_DECODING, FFMS_ERROR_INVALID_ARGUMENT,
+			"The frame doesn't match the format and size of the buffer");
+	return &LocalFrame;
+}
+
+FFMS_Frame *FFMS_VideoSource::GetFrameField(int n, int Field) {
+	if (Field != FFMS_FIELD_TOP && Field != FFMS_FIELD_BOTTOM)
+		throw FFMS_Exception(FFMS_ERROR_DECODING, FFMS_ERROR_INVALID_ARGUMENT,
+			"Invalid field");
+
+	TargetField = Field;
+	try {
+		GetFrame(n);
+	} catch (...) {
+		TargetField = FFMS_FIELD_NONE;
+		throw;
+	}
+	TargetField = FFMS_FIELD_NONE;
+	return &LocalFrame;
+}
+
+FFMS_Frame *FFMS_VideoSource::GetFrameDirect(int n, uint8_t *const *Data, const int *Linesize, PixelFormat Format, int Width, int Height) {
+	DirectData = Data;
+	DirectLinesize = Linesize;
+	DirectFormat = Format;
+	DirectWidth = Width;
+	DirectHeight = Height;
+	try {
+		GetFrame(n);
+	} catch (...) {
+		DirectData = NULL;
+		DirectLinesize = NULL;
+		DirectFormat = PIX_FMT_NONE;
+		throw;
+	}
+	DirectData = NULL;
+	DirectLinesize = NULL;
+	DirectFormat = PIX_FMT_NONE;
+	return &LocalFrame;
+}
+
+// The format and size of the frames OutputFrame produces with the current settings
+void FFMS_VideoSource::GetOutputSize(PixelFormat &Format, int &Width, int &Height) {
+	if (CurrentScaler) {
+		Format = OutputFormat;
+		Width = TargetWidth;
+		Height = TargetHeight;
+	} else {
+		int Left, Top;
+		GetCropRect(Left, Top, Width, Height);
+		Format = CodecContext->pix_fmt;
+	}
+}
+
 FFMS_Frame *FFMS_VideoSource::GetFrameByTime(double Time) {
-	int Frame = Frames.ClosestFrameFromPTS(static_cast<int64_t>((Time * 1000 * Frames.TB.Den) / Frames.TB.Num));
+	int Frame = Frames.ClosestFrameFromTime(Time);
 	return GetFrame(Frame);
 }
 
+void FFMS_VideoSource::GetFrames(const int *FrameNumbers, int NumFrames, TFrameCallback FC, void *Private) {
+	std::vector<std::pair<int, int> > Requests;
+	Requests.reserve(NumFrames);
+	for (int i = 0; i < NumFrames; i++) {
+		GetFrameCheck(FrameNumbers[i]);
+		Requests.push_back(std::make_pair(FrameNumbers[i], i));
+	}
+
+	// Visiting the frames in ascending order means each GOP is decoded at most
+	// once and GetFrame only has to seek when skipping ahead to a later GOP
+	std::sort(Requests.begin(), Requests.end());
+
+	if (Requests.size() > 1 && InitIntraDecoders()) {
+		GetIntraFrames(Requests, FC, Private);
+		return;
+	}
+
+	for (size_t i = 0; i < Requests.size(); i++) {
+		FFMS_Frame *Frame = GetFrame(Requests[i].first);
+		if ((*FC)(Requests[i].first, Requests[i].second, Frame, Private))
+			throw FFMS_Exception(FFMS_ERROR_CANCELLED, FFMS_ERROR_USER,
+				"Cancelled by user");
+	}
+}
+
+struct TensorBatch {
+	std::auto_ptr<TensorConverter> Converter;
+	uint8_t *Tensor;
+	int Width;
+	int Height;
+	int Type;
+	const float *Mean;
+	const float *Std;
+};
+
+static int FFMS_CC WriteTensorFrame(int, int Position, const FFMS_Frame *Frame, void *Private) {
+	TensorBatch *Batch = static_cast<TensorBatch *>(Private);
+	if (Frame->ScaledWidth != Batch->Width || Frame->ScaledHeight != Batch->Height)
+		throw FFMS_Exception(FFMS_ERROR_SCALING, FFMS_ERROR_INVALID_ARGUMENT,
+			"The frames don't have the size of the tensor");
+
+	// The best output format can differ between frames if the input format does
+	PixelFormat Format = static_cast<PixelFormat>(Frame->ConvertedPixelFormat);
+	if (!Batch->Converter.get() || Batch->Converter->GetFormat() != Format)
+		Batch->Converter.reset(new TensorConverter(Format, Batch->Type, Batch->Mean, Batch->Std));
+
+	size_t FrameSize = Batch->Converter->GetSize(Batch->Width, Batch->Height);
+	Batch->Converter->Convert(Frame->Data[0], Frame->Linesize[0], Batch->Width, Batch->Height, Batch->Tensor + Position * FrameSize);
+	return 0;
+}
+
+void FFMS_VideoSource::GetFramesTensor(const int *FrameNumbers, int NumFrames, void *Tensor, int Width, int Height, int Type, const float *Mean, const float *Std) {
+	if (TargetPixelFormats.empty())
+		throw FFMS_Exception(FFMS_ERROR_SCALING, FFMS_ERROR_INVALID_ARGUMENT,
+			"An RGB output format has to be set to make tensors");
+
+	TensorBatch Batch;
+	Batch.Tensor = static_cast<uint8_t *>(Tensor);
+	Batch.Width = Width;
+	Batch.Height = Height;
+	Batch.Type = Type;
+	Batch.Mean = Mean;
+	Batch.Std = Std;
+	GetFrames(FrameNumbers, NumFrames, WriteTensorFrame, &Batch);
+}
+
+FFMS_Frame *FFMS_VideoSource::GetNearestKeyFrame(int n, int *KeyFrame) {
+	GetFrameCheck(n);
+
+	int KF = Frames.FindNearestKeyFrame(n);
+	if (KeyFrame)
+		*KeyFrame = KF;
+
+	if (LastFrameNum == KF && !LocalFrameDirect && LocalFrame.Field == TargetField && LastOutputFrame)
+		return &LocalFrame;
+
+	if (!DecodeKeyFrame(KF))
+		return GetFrame(KF);
+
+	LastFrameNum = KF;
+	return OutputDecodeFrame();
+}
+
+FFMS_Frame *FFMS_VideoSource::GetNearestKeyFrameByTime(double Time, int *KeyFrame) {
+	int Frame = Frames.ClosestFrameFromTime(Time);
+	return GetNearestKeyFrame(Frame, KeyFrame);
+}
+
+bool OutputSettings::operator==(const OutputSettings &Other) const {
+	return PP == Other.PP
+		&& TargetPixelFormats == Other.TargetPixelFormats
+		&& TargetWidth == Other.TargetWidth
+		&& TargetHeight == Other.TargetHeight
+		&& TargetResizer == Other.TargetResizer
+		&& InputFormatOverridden == Other.InputFormatOverridden
+		&& InputFormat == Other.InputFormat
+		&& InputColorRange == Other.InputColorRange
+		&& InputColorSpace == Other.InputColorSpace
+		&& CropLeft == Other.CropLeft
+		&& CropTop == Other.CropTop
+		&& CropRight == Other.CropRight
+		&& CropBottom == Other.CropBottom;
+}
+
+FFMS_VideoSource *FFMS_VideoSource::Duplicate() {
+	return NULL;
+}
+
+OutputSettings FFMS_VideoSource::GetOutputSettings() const {
+	OutputSettings Settings;
+	Settings.PP = PPString;
+	Settings.TargetPixelFormats = TargetPixelFormats;
+	Settings.TargetWidth = TargetWidth;
+	Settings.TargetHeight = TargetHeight;
+	Settings.TargetResizer = TargetResizer;
+	Settings.InputFormatOverridden = InputFormatOverridden;
+	Settings.InputFormat = InputFormat;
+	Settings.InputColorRange = InputColorRange;
+	Settings.InputColorSpace = InputColorSpace;
+	Settings.CropLeft = CropLeft;
+	Settings.CropTop = CropTop;
+	Settings.CropRight = CropRight;
+	Settings.CropBottom = CropBottom;
+	return Settings;
+}
+
+void FFMS_VideoSource::ApplyOutputSettings(const OutputSettings &Settings) {
+	if (Settings.PP != PPString) {
+		if (Settings.PP.empty())
+			ResetPP();
+		else
+			SetPP(Settings.PP.c_str());
+	}
+
+	if (Settings.InputFormatOverridden)
+		SetInputFormat(Settings.InputColorSpace, Settings.InputColorRange, Settings.InputFormat);
+	else if (InputFormatOverridden)
+		ResetInputFormat();
+
+	// Applied by setting the output format below
+	CropLeft = Settings.CropLeft;
+	CropTop = Settings.CropTop;
+	CropRight = Settings.CropRight;
+	CropBottom = Settings.CropBottom;
+
+	if (!Settings.TargetPixelFormats.empty()) {
+		std::vector<PixelFormat> Formats(Settings.TargetPixelFormats);
+		Formats.push_back(PIX_FMT_NONE);
+		SetOutputFormat(&Formats[0], Settings.TargetWidth, Settings.TargetHeight, Settings.TargetResizer);
+	} else if (!TargetPixelFormats.empty()) {
+		ResetOutputFormat();
+	}
+}
+
+bool FFMS_VideoSource::DecodeKeyFrame(int) {
+	return false;
+}
+
+bool FFMS_VideoSource::DecodeSinglePacket(AVPacket &Packet) {
+	// Whatever the decoder was doing is thrown away, so make sure the next
+	// call to GetFrame seeks
+	FlushBuffers(CodecContext);
+	CurrentFrame = Frames.size();
+	LastFrameNum = -1;
+	DelayCounter = 0;
+	InitialDecode = 1;
+	CodecContext->skip_frame = AVDISCARD_DEFAULT;
+
+	int FrameFinished = 0;
+	avcodec_decode_video2(CodecContext, DecodeFrame, &FrameFinished, &Packet);
+
+	// Drain the decoder instead of feeding it more packets
+	AVPacket NullPacket;
+	InitNullPacket(NullPacket);
+	for (int i = 0; !FrameFinished && i <= FFMS_CALCULATE_DELAY; i++)
+		avcodec_decode_video2(CodecContext, DecodeFrame, &FrameFinished, &NullPacket);
+
+	if (FrameFinished)
+		DecodedPictures++;
+
+	return FrameFinished != 0;
+}
+
 static AVColorRange handle_jpeg(PixelFormat *format) {
 	switch (*format) {
 		case PIX_FMT_YUVJ420P: *format = PIX_FMT_YUV420P; return AVCOL_RANGE_JPEG;
@@ -304,7 +871,128 @@ static AVColorRange handle_jpeg(PixelFormat *format) {
 	}
 }
 
+struct OutputPicture {
+	AVPicture Picture;
+	int Width;
+	int Height;
+	PixelFormat Format;
+	AVColorSpace ColorSpace;
+	AVColorRange ColorRange;
+};
+
+void FFMS_VideoSource::OutputExtraFrames(const AVPicture &Decoded) {
+	// Work out what the decoded picture is the same way ReAdjustOutputFormat does
+	int Left, Top;
+	OutputPicture Previous;
+	Previous.Picture = Decoded;
+	GetCropRect(Left, Top, Previous.Width, Previous.Height);
+	Previous.Format = InputFormat == PIX_FMT_NONE ? CodecContext->pix_fmt : InputFormat;
+	AVColorRange RangeFromFormat = handle_jpeg(&Previous.Format);
+	Previous.ColorRange = InputColorRange;
+	if (Previous.ColorRange == AVCOL_RANGE_UNSPECIFIED)
+		Previous.ColorRange = RangeFromFormat;
+	if (Previous.ColorRange == AVCOL_RANGE_UNSPECIFIED)
+		Previous.ColorRange = CodecContext->color_range;
+	if (Previous.ColorRange == AVCOL_RANGE_UNSPECIFIED)
+		Previous.ColorRange = AVCOL_RANGE_MPEG;
+	Previous.ColorSpace = InputColorSpace;
+	if (Previous.ColorSpace == AVCOL_SPC_UNSPECIFIED)
+		Previous.ColorSpace = CodecContext->colorspace;
+	if (Previous.ColorSpace == AVCOL_SPC_UNSPECIFIED)
+		Previous.ColorSpace = GetAssumedColorSpace(CodecContext->width, CodecContext->height);
+	OutputPicture Source = Previous;
+
+	if (CurrentScaler) {
+		Previous.Picture = SWSFrame;
+		Previous.Width = TargetWidth;
+		Previous.Height = TargetHeight;
+		Previous.Format = OutputFormat;
+		Previous.ColorSpace = OutputColorSpace;
+		Previous.ColorRange = OutputColorRange;
+	}
+
+	for (size_t i = 0; i < ExtraOutputs.size(); i++) {
+		ExtraOutput &Output = *ExtraOutputs[i];
+		const OutputPicture &In = Output.Cascade ? Previous : Source;
+
+		OutputPicture Out = In;
+		Out.Width = Output.Width;
+		Out.Height = Output.Height;
+		Out.Format = FindBestPixelFormat(Output.TargetPixelFormats, In.Format);
+		AVColorRange Range = handle_jpeg(&Out.Format);
+		if (Range != AVCOL_RANGE_UNSPECIFIED)
+			Out.ColorRange = Range;
+
+		if (Out.Width != In.Width || Out.Height != In.Height || Out.Format != In.Format || Out.ColorRange != In.ColorRange) {
+			ScalerSettings Settings = {
+				In.Width, In.Height, In.Format, In.ColorSpace, In.ColorRange,
+				Out.Width, Out.Height, Out.Format, Out.ColorSpace, Out.ColorRange,
+				GetSWSCPUFlags() | (Preview ? SWS_FAST_BILINEAR : Output.Resizer)
+			};
+			ScalerCache::Scaler *Scaler = Output.Scalers.Get(Settings, 1);
+			if (!Scaler)
+				throw FFMS_Exception(FFMS_ERROR_SCALING, FFMS_ERROR_INVALID_ARGUMENT,
+					"Failed to allocate SWScale context");
+
+			if (Scaler->Convert)
+				Scaler->Convert(In.Picture.data, In.Picture.linesize, Scaler->Frame.data, Scaler->Frame.linesize, In.Width, In.Height);
+			else
+				sws_scale(Scaler->Context, In.Picture.data, In.Picture.linesize, 0, In.Height, Scaler->Frame.data, Scaler->Frame.linesize);
+			Out.Picture = Scaler->Frame;
+		}
+
+		Output.Frame = LocalFrame;
+		CopyAVPictureFields(Out.Picture, Output.Frame);
+		Output.Frame.ScaledWidth = Out.Width;
+		Output.Frame.ScaledHeight = Out.Height;
+		Output.Frame.ConvertedPixelFormat = Out.Format;
+		Output.Frame.ColorSpace = Out.ColorSpace;
+		Output.Frame.ColorRange = Out.ColorRange;
+		Previous = Out;
+	}
+}
+
+int FFMS_VideoSource::AddOutputFormat(const PixelFormat *TargetFormats, int Width, int Height, int Resizer, bool Cascade) {
+	Open();
+	if (Width <= 0 || Height <= 0 || *TargetFormats == PIX_FMT_NONE)
+		throw FFMS_Exception(FFMS_ERROR_SCALING, FFMS_ERROR_INVALID_ARGUMENT,
+			"Invalid output format");
+
+	std::auto_ptr<ExtraOutput> Output(new ExtraOutput);
+	while (*TargetFormats != PIX_FMT_NONE)
+		Output->TargetPixelFormats.push_back(*TargetFormats++);
+	Output->Width = Width;
+	Output->Height = Height;
+	Output->Resizer = Resizer;
+	Output->Cascade = Cascade;
+	ExtraOutputs.push_back(Output.release());
+
+	try {
+		OutputFrame(DecodeFrame);
+	} catch (FFMS_Exception &) {
+		delete ExtraOutputs.back();
+		ExtraOutputs.pop_back();
+		throw;
+	}
+	return static_cast<int>(ExtraOutputs.size());
+}
+
+FFMS_Frame *FFMS_VideoSource::GetOutputFrame(int Output) {
+	Open();
+	if (Output < 0 || Output > static_cast<int>(ExtraOutputs.size()))
+		throw FFMS_Exception(FFMS_ERROR_SCALING, FFMS_ERROR_INVALID_ARGUMENT,
+			"Out of bounds output requested");
+	return Output ? &ExtraOutputs[Output - 1]->Frame : &LocalFrame;
+}
+
+void FFMS_VideoSource::ResetExtraOutputs() {
+	for (size_t i = 0; i < ExtraOutputs.size(); i++)
+		delete ExtraOutputs[i];
+	ExtraOutputs.clear();
+}
+
 void FFMS_VideoSource::SetOutputFormat(const PixelFormat *TargetFormats, int Width, int Height, int Resizer) {
+	Open();
 	TargetWidth = Width;
 	TargetHeight = Height;
 	TargetResizer = Resizer;
@@ -318,6 +1006,7 @@ void FFMS_VideoSource::SetOutputFormat(const PixelFormat *TargetFormats, int Wid
 }
 
 void FFMS_VideoSource::SetInputFormat(int ColorSpace, int ColorRange, PixelFormat Format) {
+	Open();
 	InputFormatOverridden = true;
 
 	if (Format != PIX_FMT_NONE)
@@ -333,11 +1022,18 @@ void FFMS_VideoSource::SetInputFormat(int ColorSpace, int ColorRange, PixelForma
 	}
 }
 
+// Splitting only works without vertical scaling since every band is
+// converted as a separate picture, and isn't worth it for small pictures
+static int CountScaleBands(const ScalerSettings &Settings, int Threads) {
+	if (Threads < 2 || Settings.SrcH != Settings.DstH)
+		return 1;
+	if ((av_pix_fmt_descriptors[Settings.SrcFormat].flags | av_pix_fmt_descriptors[Settings.DstFormat].flags) & PIX_FMT_PAL)
+		return 1;
+	return FFMAX(1, FFMIN(Threads, Settings.SrcH / MIN_SCALE_BAND_HEIGHT));
+}
+
 void FFMS_VideoSource::ReAdjustOutputFormat() {
-	if (SWS) {
-		sws_freeContext(SWS);
-		SWS = NULL;
-	}
+	CurrentScaler = NULL;
 
 	if (InputFormat == PIX_FMT_NONE)
 		InputFormat = CodecContext->pix_fmt;
@@ -374,33 +1070,141 @@ void FFMS_VideoSource::ReAdjustOutputFormat() {
 	if (OutputColorSpace == AVCOL_SPC_UNSPECIFIED)
 		OutputColorSpace = InputColorSpace;
 
+	int Left, Top, Width, Height;
+	GetCropRect(Left, Top, Width, Height);
+
 	if (InputFormat != OutputFormat ||
-		TargetWidth != CodecContext->width ||
-		TargetHeight != CodecContext->height ||
+		TargetWidth != Width ||
+		TargetHeight != Height ||
 		InputColorSpace != OutputColorSpace ||
 		InputColorRange != OutputColorRange)
 	{
-		SWS = GetSwsContext(
-			CodecContext->width, CodecContext->height, InputFormat, InputColorSpace, InputColorRange,
+		ScalerSettings Settings = {
+			Width, Height, InputFormat, InputColorSpace, InputColorRange,
 			TargetWidth, TargetHeight, OutputFormat, OutputColorSpace, OutputColorRange,
-			GetSWSCPUFlags() | TargetResizer);
+			GetSWSCPUFlags() | (Preview ? SWS_FAST_BILINEAR : TargetResizer)
+		};
+
+		int Bands = CountScaleBands(Settings, DecodingThreads);
+		if (Bands > 1 && !ScalePool.get()) {
+			try {
+				ScalePool.reset(new FFThreadPool(DecodingThreads));
+			} catch (FFMS_Exception &) {
+				Bands = 1;
+			}
+		}
+
+		CurrentScaler = Scalers.Get(Settings, Bands);
 
-		if (!SWS) {
+		if (!CurrentScaler) {
 			ResetOutputFormat();
 			throw FFMS_Exception(FFMS_ERROR_SCALING, FFMS_ERROR_INVALID_ARGUMENT,
 				"Failed to allocate SWScale context");
 		}
+
+		SWSFrame = CurrentScaler->Frame;
+	}
+}
+
+ScalerCache::Scaler *FFMS_VideoSource::GetFieldScaler() {
+	ScalerSettings Settings = CurrentScaler->Settings;
+	Settings.SrcH /= 2;
+	Settings.DstH /= 2;
+
+	ScalerCache::Scaler *Scaler = FieldScalers.Get(Settings, ScalePool.get() ? CountScaleBands(Settings, DecodingThreads) : 1);
+	if (!Scaler)
+		throw FFMS_Exception(FFMS_ERROR_SCALING, FFMS_ERROR_INVALID_ARGUMENT,
+			"Failed to allocate SWScale context");
+	return Scaler;
+}
+
+#ifdef FFMS_USE_POSTPROC
+struct PPJob {
+	FFMS_VideoSource *Source;
+	const AVFrame *Frame;
+};
+
+void FFMS_VideoSource::PPBandJob(void *Arg, int Index) {
+	PPJob *Job = static_cast<PPJob *>(Arg);
+	FFMS_VideoSource *Source = Job->Source;
+	PPBand &Band = Source->PPBands[Index];
+	const AVFrame *Frame = Job->Frame;
+	PixelFormat Format = Source->CodecContext->pix_fmt;
+	int Width = Source->CodecContext->width;
+
+	const uint8_t *Src[3];
+	for (int i = 0; i < 3; i++)
+		Src[i] = Frame->data[i] + (Band.Start >> PlaneShift(Format, i)) * Frame->linesize[i];
+	// One row of quantizers per 16 picture rows
+	const int8_t *QP = Frame->qscale_table ? Frame->qscale_table + (Band.Start >> 4) * Frame->qstride : NULL;
+	pp_postprocess(Src, Frame->linesize, Band.Frame.data, Band.Frame.linesize, Width, Band.Rows, QP, Frame->qstride, Source->PPMode, Band.Context, Frame->pict_type | (Frame->qscale_type ? PP_PICT_TYPE_QP2 : 0));
+
+	AVPicture &Dst = Source->PPFrame;
+	for (int i = 0; i < 3; i++) {
+		int Shift = PlaneShift(Format, i);
+		int First = Band.Skip >> Shift;
+		int Last = (Band.Skip + Band.Height + (1 << Shift) - 1) >> Shift;
+		av_image_copy_plane(
+			Dst.data[i] + ((Band.Start + Band.Skip) >> Shift) * Dst.linesize[i], Dst.linesize[i],
+			Band.Frame.data[i] + First * Band.Frame.linesize[i], Band.Frame.linesize[i],
+			av_image_get_linesize(Format, Width, i), Last - First);
+	}
+}
+
+void FFMS_VideoSource::PostProcess(AVFrame *Frame) {
+	if (PPBands.empty() || !ScalePool.get()) {
+		pp_postprocess(const_cast<const uint8_t **>(Frame->data), Frame->linesize, PPFrame.data, PPFrame.linesize, CodecContext->width, CodecContext->height, Frame->qscale_table, Frame->qstride, PPMode, PPContext, Frame->pict_type | (Frame->qscale_type ? PP_PICT_TYPE_QP2 : 0));
+		return;
 	}
 
-	avpicture_free(&SWSFrame);
-	avpicture_alloc(&SWSFrame, OutputFormat, TargetWidth, TargetHeight);
+	PPJob Job = { this, Frame };
+	ScalePool->Run(PPBandJob, &Job, static_cast<int>(PPBands.size()));
 }
+#endif // FFMS_USE_POSTPROC
 
-void FFMS_VideoSource::ResetOutputFormat() {
-	if (SWS) {
-		sws_freeContext(SWS);
-		SWS = NULL;
+// The planes can only be offset to a whole chroma sample and whole bytes
+static bool CropFits(const AVCodecContext *Context, int Left, int Top, int Right, int Bottom) {
+	const AVPixFmtDescriptor &Desc = av_pix_fmt_descriptors[Context->pix_fmt];
+	return Left >= 0 && Top >= 0 && Right >= 0 && Bottom >= 0 &&
+		Left + Right < Context->width && Top + Bottom < Context->height &&
+		!(Left & ((1 << Desc.log2_chroma_w) - 1)) && !(Top & ((1 << Desc.log2_chroma_h) - 1)) &&
+		!((Left || Top) && (Desc.flags & PIX_FMT_BITSTREAM));
+}
+
+void FFMS_VideoSource::SetCrop(int Left, int Top, int Right, int Bottom) {
+	Open();
+	if (!CropFits(CodecContext, Left, Top, Right, Bottom))
+		throw FFMS_Exception(FFMS_ERROR_SCALING, FFMS_ERROR_INVALID_ARGUMENT,
+			"Invalid crop rectangle");
+
+	CropLeft = Left;
+	CropTop = Top;
+	CropRight = Right;
+	CropBottom = Bottom;
+
+	if (TargetHeight > 0 && TargetWidth > 0 && !TargetPixelFormats.empty())
+		ReAdjustOutputFormat();
+	OutputFrame(DecodeFrame);
+}
+
+void FFMS_VideoSource::GetCropRect(int &Left, int &Top, int &Width, int &Height) {
+	// A crop that doesn't fit after the frame size or format changed is ignored
+	if (CropFits(CodecContext, CropLeft, CropTop, CropRight, CropBottom)) {
+		Left = CropLeft;
+		Top = CropTop;
+		Width = CodecContext->width - CropLeft - CropRight;
+		Height = CodecContext->height - CropTop - CropBottom;
+	} else {
+		Left = 0;
+		Top = 0;
+		Width = CodecContext->width;
+		Height = CodecContext->height;
 	}
+}
+
+void FFMS_VideoSource::ResetOutputFormat() {
+	Open();
+	CurrentScaler = NULL;
 
 	TargetWidth = -1;
 	TargetHeight = -1;
@@ -414,6 +1218,7 @@ void FFMS_VideoSource::ResetOutputFormat() {
 }
 
 void FFMS_VideoSource::ResetInputFormat() {
+	Open();
 	InputFormatOverridden = false;
 	InputFormat = PIX_FMT_NONE;
 	InputColorSpace = AVCOL_SPC_UNSPECIFIED;
@@ -460,4 +1265,8 @@ void FFMS_VideoSource::SetVideoProperties() {
 	// Set AR variables
 	VP.SARNum = CodecContext->sample_aspect_ratio.num;
 	VP.SARDen = CodecContext->sample_aspect_ratio.den;
+
+	VP.EncodedWidth = CodecContext->width;
+	VP.EncodedHeight = CodecContext->height;
+	VP.EncodedPixelFormat = CodecContext->pix_fmt;
 }
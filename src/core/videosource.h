@@ -31,13 +31,18 @@ extern "C" {
 }
 
 #include <algorithm>
+#include <deque>
+#include <list>
+#include <map>
 #include <memory>
+#include <set>
 #include <sstream>
 #include <vector>
 
 #include "ffms.h"
 #include "ffmscompat.h"
 #include "indexing.h"
+#include "threading.h"
 #include "utils.h"
 #include "videoutils.h"
 
@@ -53,14 +58,308 @@ extern "C" {
 #	include "guids.h"
 #endif
 
+#define SCALER_CACHE_SIZE 4
+#define FIELD_SCALER_CACHE_SIZE 2
+#define SCALE_BAND_ALIGNMENT 16
+#define SCALE_BAND_MARGIN 16
+#define MIN_SCALE_BAND_HEIGHT 128
+
+// Recently read compressed packets, keyed by the number of the frame they
+// belong to and evicted least recently used first once over MaxSize bytes.
+// Nothing is stored until Activate() is called, or while MaxSize is 0.
+class PacketCache {
+private:
+	struct Entry {
+		AVPacket Packet;
+		std::list<int>::iterator Use;
+	};
+	std::map<int, Entry> Packets;
+	std::list<int> Uses;
+	int64_t Size;
+	int64_t MaxSize;
+	bool Active;
+
+	void Remove(std::map<int, Entry>::iterator It);
+	PacketCache(const PacketCache &);
+	PacketCache &operator=(const PacketCache &);
+public:
+	PacketCache();
+	~PacketCache();
+	void SetMaxSize(int64_t MaxSize);
+	void Activate() { Active = true; }
+	bool Has(int n) const { return Packets.find(n) != Packets.end(); }
+	// The returned packet still belongs to the cache and stays valid until the next Put
+	const AVPacket *Get(int n);
+	void Put(int n, const AVPacket &Packet);
+	void Clear();
+};
+
+// Everything an SwsContext is created from
+struct ScalerSettings {
+	int SrcW;
+	int SrcH;
+	PixelFormat SrcFormat;
+	int SrcColorSpace;
+	int SrcColorRange;
+	int DstW;
+	int DstH;
+	PixelFormat DstFormat;
+	int DstColorSpace;
+	int DstColorRange;
+	int64_t Flags;
+
+	bool operator==(const ScalerSettings &Other) const;
+};
+
+// The most recently used SwsContexts together with a picture to scale into,
+// so that streams alternating between a few frame sizes or formats don't
+// rebuild the filter tables and reallocate the output on every switch
+class ScalerCache {
+public:
+	// A horizontal band of the picture converted on its own by another
+	// thread. It includes a few rows above and below so the vertical chroma
+	// filters see the same input as for the whole picture, but only the
+	// band itself is copied to the output.
+	struct Band {
+		SwsContext *Context;
+		AVPicture Frame;
+		int Start;
+		int Rows;
+		int Skip;
+		int Height;
+	};
+	struct Scaler {
+		ScalerSettings Settings;
+		SwsContext *Context;
+		AVPicture Frame;
+		std::vector<Band> Bands;
+		// Used instead of Context when set, Context is NULL then
+		FastConvertFunc Convert;
+	};
+private:
+	std::list<Scaler> Scalers;
+	size_t MaxScalers;
+
+	static void FreeBands(Scaler &S);
+	static void Free(Scaler &S);
+
+	ScalerCache(const ScalerCache &);
+	ScalerCache &operator=(const ScalerCache &);
+public:
+	explicit ScalerCache(size_t MaxScalers);
+	~ScalerCache();
+	// Returns NULL if no context could be created for the settings. The
+	// scaler still belongs to the cache and stays valid until it is evicted.
+	// Bands is how many parts the picture should be split into for
+	// conversion on different threads
+	Scaler *Get(const ScalerSettings &Settings, int Bands);
+	void Clear();
+};
+
+// A conversion of every output frame in addition to the one set with
+// SetOutputFormat, either from the decoded picture or from the previous output
+struct ExtraOutput {
+	std::vector<PixelFormat> TargetPixelFormats;
+	int Width;
+	int Height;
+	int Resizer;
+	bool Cascade;
+	ScalerCache Scalers;
+	FFMS_Frame Frame;
+
+	ExtraOutput() : Scalers(2) { }
+};
+
+// A decoder with its own file handle and codec context which can decode any
+// frame of an all-intra track independently of the source's main decoder
+class IntraDecoder {
+private:
+	IntraDecoder(const IntraDecoder &);
+	IntraDecoder &operator=(const IntraDecoder &);
+protected:
+	bool Opened;
+	bool DecodePacket(AVPacket &Packet);
+public:
+	AVCodecContext *CodecContext;
+	AVFrame *Frame;
+
+	IntraDecoder();
+	virtual ~IntraDecoder();
+	void Open(AVCodec *Codec);
+	// Returns false if the frame couldn't be decoded on its own
+	virtual bool Decode(int n) = 0;
+};
+
+// A copy of a picture exactly as the decoder output it, before any
+// postprocessing or conversion
+class DecodedPicture {
+private:
+	AVPicture Picture;
+
+	DecodedPicture(const DecodedPicture &);
+	DecodedPicture &operator=(const DecodedPicture &);
+public:
+	AVFrame *Frame;
+	PixelFormat Format;
+	int Width;
+	int Height;
+	int Size;
+
+	DecodedPicture(const AVFrame *Src, PixelFormat Format, int Width, int Height);
+	~DecodedPicture();
+};
+
+// A frame handed out by GetFrameRef. Frame has to be the first member since
+// the handle given to the user is a pointer to it.
+struct FrameRef {
+	FFMS_Frame Frame;
+	AVPicture Picture;
+	int RefCount;
+	FFMS_VideoSource *Source;
+
+	FrameRef();
+	~FrameRef();
+};
+
+// Everything set by the caller which affects how frames are output
+struct OutputSettings {
+	std::string PP;
+	std::vector<PixelFormat> TargetPixelFormats;
+	int TargetWidth;
+	int TargetHeight;
+	int TargetResizer;
+	bool InputFormatOverridden;
+	PixelFormat InputFormat;
+	AVColorRange InputColorRange;
+	AVColorSpace InputColorSpace;
+	int CropLeft;
+	int CropTop;
+	int CropRight;
+	int CropBottom;
+
+	bool operator==(const OutputSettings &Other) const;
+};
+
+// Decodes the exact frames for GetFrameProgressive on a second instance of
+// the source, so the caller can keep using the original one meanwhile
+class ProgressiveRefiner {
+private:
+	std::auto_ptr<FFMS_VideoSource> Source;
+	OutputSettings Applied;
+
+	FFMutex Lock;
+	FFCondition Wake;
+	FFCondition Idle;
+	int Frame;
+	OutputSettings Settings;
+	TExactFrameCallback Callback;
+	void *Private;
+	unsigned Request;
+	unsigned Started;
+	bool Pending;
+	bool Running;
+	bool Quit;
+	std::auto_ptr<FFThread> Thread;
+
+	static void ThreadMain(void *Refiner);
+	void Refine();
+public:
+	explicit ProgressiveRefiner(FFMS_VideoSource *Source);
+	~ProgressiveRefiner();
+	bool Aborted();
+	void Post(int n, const OutputSettings &Settings, TExactFrameCallback Callback, void *Private);
+	void Cancel(bool Wait);
+};
+
+// Delivers the frames requested with GetFramesAsync from threads of its own.
+// A second instance of the source demuxes, decodes, postprocesses and crops
+// on one thread and hands over copies of the pictures it would have scaled
+// to the other thread, which scales them, so decoding the next frame
+// overlaps with converting the previous one.
+class FramePipeline {
+private:
+	struct Request {
+		int n;
+		int Position;
+		TFrameCallback Callback;
+		void *Private;
+		OutputSettings Settings;
+		unsigned Generation;
+	};
+
+	struct Decoded {
+		Request Req;
+		// The output frame, with the planes in Picture until it is scaled
+		FFMS_Frame Frame;
+		AVPicture Picture;
+		bool Scale;
+		ScalerSettings Scaling;
+	};
+
+	std::auto_ptr<FFMS_VideoSource> Decoder;
+	OutputSettings Applied;
+	// Only used by the converter thread
+	ScalerCache Scalers;
+
+	FFMutex Lock;
+	FFCondition Changed;
+	std::deque<Request> Pending;
+	std::deque<Decoded> Queue;
+	// Requests that haven't been delivered or dropped yet
+	int Outstanding;
+	unsigned Generation;
+	bool Quit;
+	FFMS_Exception *Error;
+	std::auto_ptr<FFThread> DecodeThread;
+	std::auto_ptr<FFThread> ConvertThread;
+
+	static void DecodeMain(void *Pipeline);
+	static void ConvertMain(void *Pipeline);
+	void Decode();
+	void Convert();
+	// Lock must be held for these
+	void Drop();
+	void Fail(const FFMS_Exception &e);
+public:
+	explicit FramePipeline(FFMS_VideoSource *Decoder);
+	~FramePipeline();
+	void Submit(const std::vector<std::pair<int, int> > &Frames, TFrameCallback Callback, void *Private, const OutputSettings &Settings);
+	void Wait();
+	void Cancel();
+};
+
 struct FFMS_VideoSource {
 friend class FFSourceResources<FFMS_VideoSource>;
+friend class ProgressiveRefiner;
+friend class FramePipeline;
 private:
 #ifdef FFMS_USE_POSTPROC
 	pp_context *PPContext;
 	pp_mode *PPMode;
+
+	// Like ScalerCache::Band, but each band is postprocessed with its
+	// own context and the margins are whole macroblock rows
+	struct PPBand {
+		pp_context *Context;
+		AVPicture Frame;
+		int Start;
+		int Rows;
+		int Skip;
+		int Height;
+	};
+	std::vector<PPBand> PPBands;
+
+	void FreePPBands();
+	void PostProcess(AVFrame *Frame);
+	static void PPBandJob(void *Arg, int Index);
 #endif // FFMS_USE_POSTPROC
-	SwsContext *SWS;
+	std::string PPString;
+	ScalerCache Scalers;
+	// Converts fields with the settings of the frames at half the height
+	ScalerCache FieldScalers;
+	std::auto_ptr<FFThreadPool> ScalePool;
+	// SWSFrame and CurrentScaler belong to Scalers
+	ScalerCache::Scaler *CurrentScaler;
 
 	int LastFrameHeight;
 	int LastFrameWidth;
@@ -70,6 +369,7 @@ private:
 	int TargetWidth;
 	std::vector<PixelFormat> TargetPixelFormats;
 	int TargetResizer;
+	bool Preview;
 
 	PixelFormat OutputFormat;
 	AVColorRange OutputColorRange;
@@ -82,10 +382,102 @@ private:
 
 	AVPicture PPFrame;
 	AVPicture SWSFrame;
+
+	// The caller's buffer while GetFrameInto is running. If DirectFormat
+	// is set frames of any other format or size aren't written to it.
+	uint8_t *const *DirectData;
+	const int *DirectLinesize;
+	PixelFormat DirectFormat;
+	int DirectWidth;
+	int DirectHeight;
+	bool LocalFrameDirect;
+
+	// The field GetFrameField is outputting, or FFMS_FIELD_NONE
+	int TargetField;
+
+	// Set for the decoder of a FramePipeline, which scales the frames itself.
+	// LocalFrame then has the planes CurrentScaler would have been given.
+	bool DeferScaling;
+	ScalerCache::Scaler *GetFieldScaler();
+
+	// The picture LocalFrame was last converted from, NULL if that failed,
+	// and what the decoder's output in it looked like
+	AVFrame *LastOutputFrame;
+	unsigned LastOutputPicture;
+	uint8_t *LastOutputData[4];
+	int LastOutputPictType;
+	int LastOutputRepeatPict;
+	int64_t LastOutputPTS;
+	bool SameDecoderOutput() const;
+
+	// Whether OpenDecoder has run, and what it threw if it failed
+	bool Opened;
+	std::auto_ptr<FFMS_Exception> OpenError;
+
+	FFMS_Frame *GetFrameDirect(int n, uint8_t *const *Data, const int *Linesize, PixelFormat Format, int Width, int Height);
+	void GetOutputSize(PixelFormat &Format, int &Width, int &Height);
+
+	std::set<FrameRef *> FrameRefs;
+	int FrameRefLimit;
+
+	void DetachFrameRefs();
+
+	std::vector<ExtraOutput *> ExtraOutputs;
+
+	int CropLeft;
+	int CropTop;
+	int CropRight;
+	int CropBottom;
+
+	void GetCropRect(int &Left, int &Top, int &Width, int &Height);
+
+	void OutputExtraFrames(const AVPicture &Decoded);
+
+	bool AllIntra;
+	std::vector<IntraDecoder *> IntraDecoders;
+	std::auto_ptr<FFThreadPool> IntraPool;
+
+	bool InitIntraDecoders();
+	void GetIntraFrames(const std::vector<std::pair<int, int> > &Requests, TFrameCallback FC, void *Private);
+
+	std::vector<DecodedPicture *> ReverseBuffer;
+	int ReverseBufferStart;
+	int LastRequested;
+	bool FillingReverseBuffer;
+	int FirstNeeded;
+
+	void FillReverseBuffer(int n);
+	void ClearReverseBuffer();
+
+	std::map<int, DecodedPicture *> Anchors;
+	int AnchorInterval;
+	int64_t MaxAnchorSize;
+	int64_t AnchorSize;
+	// Whether nothing was skipped since the decoder was last flushed, so the
+	// pictures it outputs are the frames they're counted as
+	bool ExactDecode;
+	unsigned LastAnchorPicture;
+
+	bool PictureUsable(const DecodedPicture *Picture);
+	// The closest anchor at or before n and not before its keyframe, or -1
+	int NearestAnchor(int n);
+	FFMS_Frame *OutputAnchor(int n);
+	void ClearAnchors();
+
+	std::auto_ptr<ProgressiveRefiner> Refiner;
+	ProgressiveRefiner *Refining;
+
+	std::auto_ptr<FramePipeline> Pipeline;
+
+	int DecodeCost(int n);
+	OutputSettings GetOutputSettings() const;
+	void ApplyOutputSettings(const OutputSettings &Settings);
 protected:
 	FFMS_VideoProperties VP;
 	FFMS_Frame LocalFrame;
 	AVFrame *DecodeFrame;
+	// Counts the pictures the decoder has output into DecodeFrame
+	unsigned DecodedPictures;
 	int LastFrameNum;
 	FFMS_Index &Index;
 	FFMS_Track Frames;
@@ -94,27 +486,74 @@ protected:
 	int DelayCounter;
 	int InitialDecode;
 	int DecodingThreads;
+	int SourceFlags;
 	AVCodecContext *CodecContext;
+	// Only used by the sources which can read packets again from it
+	PacketCache Packets;
 
-	FFMS_VideoSource(const char *SourceFile, FFMS_Index &Index, int Track, int Threads);
+	FFMS_VideoSource(const char *SourceFile, FFMS_Index &Index, int Track, int Threads, int Flags);
+	void SetDecoderOptions(AVCodecContext *Context, AVCodec *Codec);
 	void ReAdjustPP(PixelFormat VPixelFormat, int Width, int Height);
 	void ReAdjustOutputFormat();
+	void ScaleFrame(ScalerCache::Scaler *Scaler, const uint8_t *const *Data, const int *Linesize, uint8_t *const *DstData, const int *DstLinesize);
 	FFMS_Frame *OutputFrame(AVFrame *Frame);
+	FFMS_Frame *OutputDecodeFrame();
+	bool DecodeSinglePacket(AVPacket &Packet);
+	virtual bool DecodeKeyFrame(int n);
+	virtual IntraDecoder *CreateIntraDecoder();
+	// Stops the pool, must be called by Free() before what the decoders use goes away
+	void FreeIntraDecoders();
+	virtual FFMS_VideoSource *Duplicate();
+	void CheckAbort();
+	FFMS_Frame *GetCachedFrame(int n);
+	// For the decode loops of the sources, CurrentFrame must be the frame being decoded
+	void StoreAnchor(int n);
+	void StoreReversePicture();
+	void SetSkipFrame(int n);
+	// Whether the packet of the given frame can be left out on the way to
+	// the frame passed to SetSkipFrame
+	bool CanDropPacket(int Frame);
 	virtual void Free(bool CloseCodec) = 0;
+	// Opens the file and the decoder and decodes the first frame
+	virtual void OpenDecoder() = 0;
+	void Open();
 	void SetVideoProperties();
+	// Fills in what the index knows before anything is opened
+	void SetIndexVideoProperties();
 public:
 	virtual ~FFMS_VideoSource();
-	const FFMS_VideoProperties& GetVideoProperties() { return VP; }
+	const FFMS_VideoProperties& GetVideoProperties();
 	FFMS_Track *GetTrack() { return &Frames; }
 	virtual FFMS_Frame *GetFrame(int n) = 0;
 	void GetFrameCheck(int n);
+	FFMS_Frame *GetFrameInto(int n, uint8_t *const *Data, const int *Linesize, PixelFormat Format, int Width, int Height);
+	FFMS_Frame *GetFrameRef(int n);
+	void SetFrameRefLimit(int MaxFrames);
+	static void AddFrameRef(const FFMS_Frame *Frame);
+	static void ReleaseFrameRef(const FFMS_Frame *Frame);
+	FFMS_Frame *GetFrameField(int n, int Field);
 	FFMS_Frame *GetFrameByTime(double Time);
+	void GetFrames(const int *FrameNumbers, int NumFrames, TFrameCallback FC, void *Private);
+	void GetFramesTensor(const int *FrameNumbers, int NumFrames, void *Tensor, int Width, int Height, int Type, const float *Mean, const float *Std);
+	FFMS_Frame *GetNearestKeyFrame(int n, int *KeyFrame);
+	FFMS_Frame *GetNearestKeyFrameByTime(double Time, int *KeyFrame);
+	FFMS_Frame *GetFrameProgressive(int n, int MaxDecode, int *FrameNum, TExactFrameCallback EFC, void *Private);
+	void CancelProgressive();
+	void GetFramesAsync(const int *FrameNumbers, int NumFrames, TFrameCallback FC, void *Private);
+	void WaitAsync();
+	void CancelAsync();
 	void SetPP(const char *PP);
 	void ResetPP();
 	void SetOutputFormat(const PixelFormat *TargetFormats, int Width, int Height, int Resizer);
 	void ResetOutputFormat();
 	void SetInputFormat(int ColorSpace, int ColorRange, PixelFormat Format);
 	void ResetInputFormat();
+	void SetAnchorCache(int Interval, int64_t MaxSize);
+	void SetPacketCache(int64_t MaxSize);
+	void SetCrop(int Left, int Top, int Right, int Bottom);
+	int AddOutputFormat(const PixelFormat *TargetFormats, int Width, int Height, int Resizer, bool Cascade);
+	FFMS_Frame *GetOutputFrame(int Output);
+	void ResetExtraOutputs();
 };
 
 class FFLAVFVideo : public FFMS_VideoSource {
@@ -123,11 +562,21 @@ private:
 	int SeekMode;
 	FFSourceResources<FFMS_VideoSource> Res;
 
+	std::string SourceFile;
+	int ReplayPacket;
+	bool ReplayFailed;
+
+	bool CanReplay(int Start, int n);
+	bool ReadPacket(AVPacket &Packet);
 	void DecodeNextFrame(int64_t *PTS, int64_t *Pos);
 protected:
+	bool DecodeKeyFrame(int n);
+	IntraDecoder *CreateIntraDecoder();
+	FFMS_VideoSource *Duplicate();
 	void Free(bool CloseCodec);
+	void OpenDecoder();
 public:
-	FFLAVFVideo(const char *SourceFile, int Track, FFMS_Index &Index, int Threads, int SeekMode);
+	FFLAVFVideo(const char *SourceFile, int Track, FFMS_Index &Index, int Threads, int SeekMode, int Flags);
 	FFMS_Frame *GetFrame(int n);
 };
 
@@ -139,12 +588,17 @@ private:
 	char ErrorMessage[256];
 	FFSourceResources<FFMS_VideoSource> Res;
 	size_t PacketNumber;
+	std::string SourceFile;
 
 	void DecodeNextFrame();
 protected:
+	bool DecodeKeyFrame(int n);
+	IntraDecoder *CreateIntraDecoder();
+	FFMS_VideoSource *Duplicate();
 	void Free(bool CloseCodec);
+	void OpenDecoder();
 public:
-	FFMatroskaVideo(const char *SourceFile, int Track, FFMS_Index &Index, int Threads);
+	FFMatroskaVideo(const char *SourceFile, int Track, FFMS_Index &Index, int Threads, int Flags);
 	FFMS_Frame *GetFrame(int n);
 };
 
@@ -155,12 +609,15 @@ class FFHaaliVideo : public FFMS_VideoSource {
 	CComPtr<IMMContainer> pMMC;
 	AVBitStreamFilterContext *BitStreamFilter;
 	FFSourceResources<FFMS_VideoSource> Res;
+	std::string SourceFile;
+	FFMS_Sources SourceMode;
 
 	void DecodeNextFrame(int64_t *AFirstStartTime);
 protected:
 	void Free(bool CloseCodec);
+	void OpenDecoder();
 public:
-	FFHaaliVideo(const char *SourceFile, int Track, FFMS_Index &Index, int Threads, FFMS_Sources SourceMode);
+	FFHaaliVideo(const char *SourceFile, int Track, FFMS_Index &Index, int Threads, FFMS_Sources SourceMode, int Flags);
 	FFMS_Frame *GetFrame(int n);
 };
 
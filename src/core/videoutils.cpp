@@ -20,6 +20,7 @@
 
 
 #include "videoutils.h"
+#include "utils.h"
 
 #include <algorithm>
 #include <math.h>
@@ -33,6 +34,18 @@ extern "C" {
 
 
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#	define FFMS_HAVE_SSE2
+#	include <emmintrin.h>
+#endif
+
+#if LIBAVUTIL_VERSION_INT >= AV_VERSION_INT(51, 0, 0)
+extern "C" {
+#include <libavutil/cpu.h>
+}
+#	define FFMS_HAVE_CPU_FLAGS
+#endif
+
 // hack
 extern int CPUFeatures;
 
@@ -123,6 +136,18 @@ int GetPPCPUFlags() {
 }
 
 
+int CountPlanes(PixelFormat Format) {
+	const AVPixFmtDescriptor &Desc = av_pix_fmt_descriptors[Format];
+	int Planes = 0;
+	for (int i = 0; i < Desc.nb_components; i++)
+		Planes = FFMAX(Planes, Desc.comp[i].plane + 1);
+	return Planes;
+}
+
+int PlaneShift(PixelFormat Format, int Plane) {
+	return (Plane == 1 || Plane == 2) ? av_pix_fmt_descriptors[Format].log2_chroma_h : 0;
+}
+
 AVColorSpace GetAssumedColorSpace(int W, int H) {
 	if (W > 1024 || H >= 600)
 		return AVCOL_SPC_BT709;
@@ -177,6 +202,297 @@ void CorrectTimebase(FFMS_VideoProperties *VP, FFMS_TrackTimeBase *TTimebase) {
 
 
 
+/***************************
+**
+** Conversions which don't need swscale at all
+**
+***************************/
+
+static void CopyPlane(const uint8_t *Src, int SrcStride, uint8_t *Dst, int DstStride, int Width, int Height) {
+	for (int y = 0; y < Height; y++)
+		memcpy(Dst + y * DstStride, Src + y * SrcStride, Width);
+}
+
+static void InterleaveChromaC(const uint8_t *U, const uint8_t *V, uint8_t *Dst, int Width) {
+	for (int x = 0; x < Width; x++) {
+		Dst[2 * x] = U[x];
+		Dst[2 * x + 1] = V[x];
+	}
+}
+
+static void PackYUYVC(const uint8_t *Y, const uint8_t *U, const uint8_t *V, uint8_t *Dst, int Width) {
+	for (int x = 0; x < Width / 2; x++) {
+		Dst[4 * x] = Y[2 * x];
+		Dst[4 * x + 1] = U[x];
+		Dst[4 * x + 2] = Y[2 * x + 1];
+		Dst[4 * x + 3] = V[x];
+	}
+}
+
+static void PackUYVYC(const uint8_t *Y, const uint8_t *U, const uint8_t *V, uint8_t *Dst, int Width) {
+	for (int x = 0; x < Width / 2; x++) {
+		Dst[4 * x] = U[x];
+		Dst[4 * x + 1] = Y[2 * x];
+		Dst[4 * x + 2] = V[x];
+		Dst[4 * x + 3] = Y[2 * x + 1];
+	}
+}
+
+#ifdef FFMS_HAVE_SSE2
+// Detected at runtime the same way libavcodec and libswscale pick their asm,
+// the caps given to FFMS_Init only matter when libavutil is too old to tell
+static bool HaveSSE2() {
+#ifdef FFMS_HAVE_CPU_FLAGS
+	return !!(av_get_cpu_flags() & AV_CPU_FLAG_SSE2);
+#else
+	return !!(CPUFeatures & FFMS_CPU_CAPS_SSE2);
+#endif
+}
+
+// All of these do 16 chroma samples at a time and leave the rest to the C versions
+
+static void InterleaveChromaSSE2(const uint8_t *U, const uint8_t *V, uint8_t *Dst, int Width) {
+	int x = 0;
+	for (; x + 16 <= Width; x += 16) {
+		__m128i u = _mm_loadu_si128(reinterpret_cast<const __m128i *>(U + x));
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(V + x));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(Dst + 2 * x), _mm_unpacklo_epi8(u, v));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(Dst + 2 * x + 16), _mm_unpackhi_epi8(u, v));
+	}
+	InterleaveChromaC(U + x, V + x, Dst + 2 * x, Width - x);
+}
+
+static void PackYUYVSSE2(const uint8_t *Y, const uint8_t *U, const uint8_t *V, uint8_t *Dst, int Width) {
+	int x = 0;
+	for (; x + 16 <= Width / 2; x += 16) {
+		__m128i y0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(Y + 2 * x));
+		__m128i y1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(Y + 2 * x + 16));
+		__m128i u = _mm_loadu_si128(reinterpret_cast<const __m128i *>(U + x));
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(V + x));
+		__m128i uv0 = _mm_unpacklo_epi8(u, v);
+		__m128i uv1 = _mm_unpackhi_epi8(u, v);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(Dst + 4 * x), _mm_unpacklo_epi8(y0, uv0));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(Dst + 4 * x + 16), _mm_unpackhi_epi8(y0, uv0));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(Dst + 4 * x + 32), _mm_unpacklo_epi8(y1, uv1));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(Dst + 4 * x + 48), _mm_unpackhi_epi8(y1, uv1));
+	}
+	PackYUYVC(Y + 2 * x, U + x, V + x, Dst + 4 * x, Width - 2 * x);
+}
+
+static void PackUYVYSSE2(const uint8_t *Y, const uint8_t *U, const uint8_t *V, uint8_t *Dst, int Width) {
+	int x = 0;
+	for (; x + 16 <= Width / 2; x += 16) {
+		__m128i y0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(Y + 2 * x));
+		__m128i y1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(Y + 2 * x + 16));
+		__m128i u = _mm_loadu_si128(reinterpret_cast<const __m128i *>(U + x));
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(V + x));
+		__m128i uv0 = _mm_unpacklo_epi8(u, v);
+		__m128i uv1 = _mm_unpackhi_epi8(u, v);
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(Dst + 4 * x), _mm_unpacklo_epi8(uv0, y0));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(Dst + 4 * x + 16), _mm_unpackhi_epi8(uv0, y0));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(Dst + 4 * x + 32), _mm_unpacklo_epi8(uv1, y1));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(Dst + 4 * x + 48), _mm_unpackhi_epi8(uv1, y1));
+	}
+	PackUYVYC(Y + 2 * x, U + x, V + x, Dst + 4 * x, Width - 2 * x);
+}
+#endif // FFMS_HAVE_SSE2
+
+static void InterleaveYUV420P(const uint8_t *const *Src, const int *SrcStride, uint8_t *const *Dst, const int *DstStride, int Width, int Height, int First) {
+	CopyPlane(Src[0], SrcStride[0], Dst[0], DstStride[0], Width, Height);
+
+	void (*Interleave)(const uint8_t *, const uint8_t *, uint8_t *, int) = InterleaveChromaC;
+#ifdef FFMS_HAVE_SSE2
+	if (HaveSSE2())
+		Interleave = InterleaveChromaSSE2;
+#endif // FFMS_HAVE_SSE2
+
+	int Second = 3 - First;
+	for (int y = 0; y < Height / 2; y++)
+		Interleave(Src[First] + y * SrcStride[First], Src[Second] + y * SrcStride[Second], Dst[1] + y * DstStride[1], Width / 2);
+}
+
+static void YUV420PToNV12(const uint8_t *const *Src, const int *SrcStride, uint8_t *const *Dst, const int *DstStride, int Width, int Height) {
+	InterleaveYUV420P(Src, SrcStride, Dst, DstStride, Width, Height, 1);
+}
+
+// Same as NV12 with V first
+static void YUV420PToNV21(const uint8_t *const *Src, const int *SrcStride, uint8_t *const *Dst, const int *DstStride, int Width, int Height) {
+	InterleaveYUV420P(Src, SrcStride, Dst, DstStride, Width, Height, 2);
+}
+
+static void PackYUV420P(const uint8_t *const *Src, const int *SrcStride, uint8_t *Dst, int DstStride, int Width, int Height,
+	void (*Pack)(const uint8_t *, const uint8_t *, const uint8_t *, uint8_t *, int)) {
+	// Every chroma row is used for two lines, the same as swscale does it
+	for (int y = 0; y < Height; y++)
+		Pack(Src[0] + y * SrcStride[0], Src[1] + (y / 2) * SrcStride[1], Src[2] + (y / 2) * SrcStride[2], Dst + y * DstStride, Width);
+}
+
+static void YUV420PToYUYV422(const uint8_t *const *Src, const int *SrcStride, uint8_t *const *Dst, const int *DstStride, int Width, int Height) {
+	void (*Pack)(const uint8_t *, const uint8_t *, const uint8_t *, uint8_t *, int) = PackYUYVC;
+#ifdef FFMS_HAVE_SSE2
+	if (HaveSSE2())
+		Pack = PackYUYVSSE2;
+#endif // FFMS_HAVE_SSE2
+	PackYUV420P(Src, SrcStride, Dst[0], DstStride[0], Width, Height, Pack);
+}
+
+static void YUV420PToUYVY422(const uint8_t *const *Src, const int *SrcStride, uint8_t *const *Dst, const int *DstStride, int Width, int Height) {
+	void (*Pack)(const uint8_t *, const uint8_t *, const uint8_t *, uint8_t *, int) = PackUYVYC;
+#ifdef FFMS_HAVE_SSE2
+	if (HaveSSE2())
+		Pack = PackUYVYSSE2;
+#endif // FFMS_HAVE_SSE2
+	PackYUV420P(Src, SrcStride, Dst[0], DstStride[0], Width, Height, Pack);
+}
+
+// Rounds to nearest even like the hardware conversions do
+static uint16_t FloatToHalf(float Value) {
+	union { float f; uint32_t u; } Bits;
+	Bits.f = Value;
+	uint32_t Sign = (Bits.u >> 16) & 0x8000;
+	int Exponent = static_cast<int>((Bits.u >> 23) & 0xFF) - 127 + 15;
+	uint32_t Mantissa = Bits.u & 0x7FFFFF;
+
+	if (((Bits.u >> 23) & 0xFF) == 0xFF)
+		return Sign | 0x7C00 | (Mantissa ? 0x200 : 0);
+	if (Exponent >= 31)
+		return Sign | 0x7C00;
+
+	int Shift = 13;
+	uint32_t Half;
+	if (Exponent <= 0) {
+		if (Exponent < -10)
+			return Sign;
+		Mantissa |= 0x800000;
+		Shift = 14 - Exponent;
+		Half = Mantissa >> Shift;
+	} else {
+		Half = (Exponent << 10) | (Mantissa >> 13);
+	}
+
+	// A carry out of the mantissa correctly bumps the exponent
+	uint32_t Rest = Mantissa & ((1u << Shift) - 1);
+	uint32_t Middle = 1u << (Shift - 1);
+	if (Rest > Middle || (Rest == Middle && (Half & 1)))
+		Half++;
+	return Sign | Half;
+}
+
+// Any format with 8 bit R, G and B interleaved in a single plane
+static bool IsPackedRGB8(PixelFormat Format) {
+	if (Format < 0 || Format >= PIX_FMT_NB)
+		return false;
+
+	const AVPixFmtDescriptor &Desc = av_pix_fmt_descriptors[Format];
+	if (!(Desc.flags & PIX_FMT_RGB) || (Desc.flags & (PIX_FMT_PAL | PIX_FMT_BITSTREAM)) || Desc.nb_components < 3)
+		return false;
+	for (int i = 0; i < 3; i++) {
+		if (Desc.comp[i].plane != 0 || Desc.comp[i].depth_minus1 != 7 || Desc.comp[i].shift != 0 ||
+			Desc.comp[i].step_minus1 != Desc.comp[0].step_minus1)
+			return false;
+	}
+	return true;
+}
+
+TensorConverter::TensorConverter(PixelFormat Format, int Type, const float *Mean, const float *Std)
+: Format(Format)
+, Type(Type)
+{
+	if (Type != FFMS_TENSOR_FLOAT32 && Type != FFMS_TENSOR_FLOAT16)
+		throw FFMS_Exception(FFMS_ERROR_SCALING, FFMS_ERROR_INVALID_ARGUMENT,
+			"Invalid tensor type");
+
+	if (!IsPackedRGB8(Format))
+		throw FFMS_Exception(FFMS_ERROR_SCALING, FFMS_ERROR_INVALID_ARGUMENT,
+			"Tensors can only be made from frames in a packed 8 bit RGB format");
+
+	const AVPixFmtDescriptor &Desc = av_pix_fmt_descriptors[Format];
+	Step = Desc.comp[0].step_minus1 + 1;
+	for (int c = 0; c < 3; c++) {
+		Offsets[c] = Desc.comp[c].offset_plus1 - 1;
+		float ChannelMean = Mean ? Mean[c] : 0.f;
+		float ChannelStd = Std ? Std[c] : 1.f;
+		if (ChannelStd == 0.f)
+			throw FFMS_Exception(FFMS_ERROR_SCALING, FFMS_ERROR_INVALID_ARGUMENT,
+				"The standard deviation can't be zero");
+
+		// (v / 255 - Mean) / Std
+		Scale[c] = 1.f / (255.f * ChannelStd);
+		Bias[c] = -ChannelMean / ChannelStd;
+		for (int v = 0; v < 256; v++) {
+			FloatTable[c][v] = v * Scale[c] + Bias[c];
+			HalfTable[c][v] = FloatToHalf(FloatTable[c][v]);
+		}
+	}
+}
+
+size_t TensorConverter::GetSize(int Width, int Height) const {
+	return 3 * static_cast<size_t>(Width) * Height * (Type == FFMS_TENSOR_FLOAT16 ? 2 : 4);
+}
+
+template<typename T>
+static void TensorRowC(const uint8_t *Src, int Step, const T *Table, T *Dst, int Width) {
+	for (int x = 0; x < Width; x++)
+		Dst[x] = Table[Src[x * Step]];
+}
+
+#ifdef FFMS_HAVE_SSE2
+// Only for four byte pixels, four of them at a time
+static void TensorRowSSE2(const uint8_t *Src, int Offset, float Scale, float Bias, const float *Table, float *Dst, int Width) {
+	const __m128i Mask = _mm_set1_epi32(0xFF);
+	const __m128i Shift = _mm_cvtsi32_si128(Offset * 8);
+	const __m128 S = _mm_set1_ps(Scale);
+	const __m128 B = _mm_set1_ps(Bias);
+	int x = 0;
+	for (; x + 4 <= Width; x += 4) {
+		__m128i Pixels = _mm_loadu_si128(reinterpret_cast<const __m128i *>(Src + 4 * x));
+		__m128i Values = _mm_and_si128(_mm_srl_epi32(Pixels, Shift), Mask);
+		_mm_storeu_ps(Dst + x, _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(Values), S), B));
+	}
+	TensorRowC(Src + 4 * x + Offset, 4, Table, Dst + x, Width - x);
+}
+#endif // FFMS_HAVE_SSE2
+
+void TensorConverter::Convert(const uint8_t *Src, int SrcStride, int Width, int Height, void *Dst) const {
+	size_t PlaneSize = static_cast<size_t>(Width) * Height;
+	for (int c = 0; c < 3; c++) {
+		for (int y = 0; y < Height; y++) {
+			const uint8_t *Row = Src + y * SrcStride;
+			size_t Start = c * PlaneSize + static_cast<size_t>(y) * Width;
+			if (Type == FFMS_TENSOR_FLOAT16) {
+				TensorRowC(Row + Offsets[c], Step, HalfTable[c], static_cast<uint16_t *>(Dst) + Start, Width);
+				continue;
+			}
+#ifdef FFMS_HAVE_SSE2
+			if (Step == 4 && (CPUFeatures & FFMS_CPU_CAPS_SSE2)) {
+				TensorRowSSE2(Row, Offsets[c], Scale[c], Bias[c], FloatTable[c], static_cast<float *>(Dst) + Start, Width);
+				continue;
+			}
+#endif // FFMS_HAVE_SSE2
+			TensorRowC(Row + Offsets[c], Step, FloatTable[c], static_cast<float *>(Dst) + Start, Width);
+		}
+	}
+}
+
+FastConvertFunc GetFastConverter(PixelFormat SrcFormat, PixelFormat DstFormat, int Width, int Height) {
+	// Odd sizes are where swscale's own special cases get inconsistent
+	if ((Width | Height) & 1)
+		return NULL;
+
+	if (SrcFormat == PIX_FMT_YUV420P) {
+		switch (DstFormat) {
+			case PIX_FMT_NV12: return YUV420PToNV12;
+			case PIX_FMT_NV21: return YUV420PToNV21;
+			case PIX_FMT_YUYV422: return YUV420PToYUYV422;
+			case PIX_FMT_UYVY422: return YUV420PToUYVY422;
+			default: break;
+		}
+	}
+	return NULL;
+}
+
+
+
 /***************************
 **
 ** Since avcodec_find_best_pix_fmt() is broken, we have our own implementation of it here.
@@ -41,8 +41,35 @@ extern "C" {
 int64_t GetSWSCPUFlags();
 SwsContext *GetSwsContext(int SrcW, int SrcH, PixelFormat SrcFormat, int SrcColorSpace, int SrcColorRange, int DstW, int DstH, PixelFormat DstFormat, int DstColorSpace, int DstColorRange, int64_t Flags);
 int GetPPCPUFlags();
+
+// conversions done without swscale, with exactly the same result
+typedef void (*FastConvertFunc)(const uint8_t *const *Src, const int *SrcStride, uint8_t *const *Dst, const int *DstStride, int Width, int Height);
+FastConvertFunc GetFastConverter(PixelFormat SrcFormat, PixelFormat DstFormat, int Width, int Height);
 AVColorSpace GetAssumedColorSpace(int Width, int Height);
 
+// the number of planes of a format, and how much smaller than the picture
+// the given plane is vertically
+int CountPlanes(PixelFormat Format);
+int PlaneShift(PixelFormat Format, int Plane);
+
+// Writes packed 8 bit RGB frames as three normalized float planes in R, G, B order
+class TensorConverter {
+private:
+	PixelFormat Format;
+	int Type;
+	int Step;
+	int Offsets[3];
+	float Scale[3];
+	float Bias[3];
+	float FloatTable[3][256];
+	uint16_t HalfTable[3][256];
+public:
+	TensorConverter(PixelFormat Format, int Type, const float *Mean, const float *Std);
+	PixelFormat GetFormat() const { return Format; }
+	size_t GetSize(int Width, int Height) const;
+	void Convert(const uint8_t *Src, int SrcStride, int Width, int Height, void *Dst) const;
+};
+
 // timebase-related functions
 void CorrectNTSCRationalFramerate(int *Num, int *Den);
 void CorrectTimebase(FFMS_VideoProperties *VP, FFMS_TrackTimeBase *TTimebase);
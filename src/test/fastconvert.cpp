@@ -0,0 +1,173 @@
+//  Copyright (c) 2012 Fredrik Mellbin
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+// Times the same-size conversions from yuv420p that bypass swscale against
+// swscale doing the same conversion, and fails if the output differs in any
+// byte. Needs a yuv420p clip with an even width and height:
+//   src/test/fastconvert clip.mkv [frame] [iterations]
+
+extern "C" {
+#include <libavutil/common.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/log.h>
+#include <libavutil/pixdesc.h>
+#include <libswscale/swscale.h>
+}
+
+#include <iostream>
+#include <string>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "ffms.h"
+#include "ffmscompat.h"
+
+static void Check(bool Condition, const std::string &What) {
+	if (!Condition)
+		throw What;
+}
+
+struct Picture {
+	uint8_t *Data[4];
+	int Linesize[4];
+
+	Picture(PixelFormat Format, int Width, int Height) {
+		if (av_image_alloc(Data, Linesize, Width, Height, Format, 16) < 0)
+			throw std::string("Out of memory");
+	}
+	~Picture() {
+		av_freep(&Data[0]);
+	}
+};
+
+static bool SamePicture(const Picture &A, const Picture &B, PixelFormat Format, int Width, int Height) {
+	const AVPixFmtDescriptor &Desc = av_pix_fmt_descriptors[Format];
+	for (int i = 0; i < 4 && A.Linesize[i] > 0; i++) {
+		int Rows = i ? -((-Height) >> Desc.log2_chroma_h) : Height;
+		int RowSize = av_image_get_linesize(Format, Width, i);
+		for (int y = 0; y < Rows; y++)
+			if (memcmp(A.Data[i] + y * A.Linesize[i], B.Data[i] + y * B.Linesize[i], RowSize))
+				return false;
+	}
+	return true;
+}
+
+static double Milliseconds(clock_t Start, int Iterations) {
+	return (clock() - Start) * 1000.0 / CLOCKS_PER_SEC / Iterations;
+}
+
+// Returns whether the output was identical
+static bool Compare(FFMS_VideoSource *V, int n, const Picture &In, int Width, int Height, const char *Name, int Iterations) {
+	char ErrorMsg[1024];
+	FFMS_ErrorInfo E;
+	E.Buffer = ErrorMsg;
+	E.BufferSize = sizeof(ErrorMsg);
+
+	PixelFormat Format = static_cast<PixelFormat>(FFMS_GetPixFmt(Name));
+	int Targets[2] = { Format, -1 };
+	Check(FFMS_SetOutputFormatV(V, Targets, Width, Height, FFMS_RESIZER_BICUBIC, &E) == FFMS_ERROR_SUCCESS,
+		std::string("Failed to set the output format: ") + E.Buffer);
+
+	// Asking for the same frame again only converts it into the buffer
+	Picture Fast(Format, Width, Height);
+	clock_t Start = clock();
+	for (int i = 0; i < Iterations; i++)
+		Check(FFMS_GetFrameInto(V, n, Fast.Data, Fast.Linesize, Format, Width, Height, &E) != NULL,
+			std::string("Failed to get frame: ") + E.Buffer);
+	double FastTime = Milliseconds(Start, Iterations);
+
+	// The same flags GetSwsContext uses
+	SwsContext *Context = sws_getContext(Width, Height, PIX_FMT_YUV420P, Width, Height, Format,
+		SWS_BICUBIC | SWS_FULL_CHR_H_INT | SWS_FULL_CHR_H_INP, 0, 0, 0);
+	Check(Context != NULL, "Failed to create a swscale context");
+	Picture Reference(Format, Width, Height);
+	Start = clock();
+	for (int i = 0; i < Iterations; i++)
+		sws_scale(Context, In.Data, In.Linesize, 0, Height, Reference.Data, Reference.Linesize);
+	double SwscaleTime = Milliseconds(Start, Iterations);
+	sws_freeContext(Context);
+
+	bool Same = SamePicture(Fast, Reference, Format, Width, Height);
+	std::cout << Name << ": " << FastTime << " ms, swscale " << SwscaleTime << " ms";
+	if (FastTime > 0)
+		std::cout << " (" << SwscaleTime / FastTime << "x)";
+	std::cout << (Same ? "" : ", OUTPUT DIFFERS") << std::endl;
+	return Same;
+}
+
+int main(int argc, char *argv[]) {
+	if (argc < 2) {
+		std::cout << "Usage: fastconvert <file> [frame] [iterations]" << std::endl;
+		return 1;
+	}
+	const char *SourceFile = argv[1];
+	int n = argc > 2 ? atoi(argv[2]) : 0;
+	int Iterations = argc > 3 ? FFMAX(atoi(argv[3]), 1) : 200;
+
+	FFMS_Init(0, 1);
+	FFMS_SetLogLevel(AV_LOG_QUIET);
+
+	char ErrorMsg[1024];
+	FFMS_ErrorInfo E;
+	E.Buffer = ErrorMsg;
+	E.BufferSize = sizeof(ErrorMsg);
+
+	FFMS_Index *Index = FFMS_MakeIndex(SourceFile, 0, 0, NULL, NULL, FFMS_IEH_ABORT, NULL, NULL, &E);
+	if (!Index) {
+		std::cout << "Indexing error: " << E.Buffer << std::endl;
+		return 1;
+	}
+
+	int Track = FFMS_GetFirstTrackOfType(Index, FFMS_TYPE_VIDEO, &E);
+	FFMS_VideoSource *V = Track < 0 ? NULL : FFMS_CreateVideoSource2(SourceFile, Track, Index, 1, FFMS_SEEK_NORMAL, 0, &E);
+	FFMS_DestroyIndex(Index);
+	if (!V) {
+		std::cout << "Failed to open video: " << E.Buffer << std::endl;
+		return 1;
+	}
+
+	bool Passed = true;
+	try {
+		const FFMS_Frame *Frame = FFMS_GetFrame(V, n, &E);
+		Check(Frame != NULL, std::string("Failed to get frame: ") + E.Buffer);
+		int Width = Frame->EncodedWidth;
+		int Height = Frame->EncodedHeight;
+		Check(Frame->ConvertedPixelFormat == PIX_FMT_YUV420P && !((Width | Height) & 1),
+			"The fast paths only convert yuv420p with an even width and height");
+
+		Picture In(PIX_FMT_YUV420P, Width, Height);
+		for (int i = 0; i < 3; i++) {
+			int Rows = i ? Height / 2 : Height;
+			int RowSize = i ? Width / 2 : Width;
+			for (int y = 0; y < Rows; y++)
+				memcpy(In.Data[i] + y * In.Linesize[i], Frame->Data[i] + y * Frame->Linesize[i], RowSize);
+		}
+
+		const char *Formats[] = { "nv12", "nv21", "yuyv422", "uyvy422" };
+		for (size_t i = 0; i < sizeof(Formats) / sizeof(Formats[0]); i++)
+			Passed &= Compare(V, n, In, Width, Height, Formats[i], Iterations);
+	} catch (const std::string &Error) {
+		std::cout << Error << std::endl;
+		Passed = false;
+	}
+
+	FFMS_DestroyVideoSource(V);
+	return Passed ? 0 : 1;
+}
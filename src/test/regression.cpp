@@ -0,0 +1,552 @@
+//  Copyright (c) 2012 Fredrik Mellbin
+//
+//  Permission is hereby granted, free of charge, to any person obtaining a copy
+//  of this software and associated documentation files (the "Software"), to deal
+//  in the Software without restriction, including without limitation the rights
+//  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//  copies of the Software, and to permit persons to whom the Software is
+//  furnished to do so, subject to the following conditions:
+//
+//  The above copyright notice and this permission notice shall be included in
+//  all copies or substantial portions of the Software.
+//
+//  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//  THE SOFTWARE.
+
+// Checks behavior of the API that is easy to break without noticing. The video
+// file to work on can be given as the first argument or in FFMS2_TEST_SAMPLE,
+// e.g. FFMS2_TEST_SAMPLE=clip.ts make check. Without one a short uncompressed
+// clip is written and used instead, which covers everything except what only
+// happens with inter frames, so a long-GOP sample is still worth testing with.
+
+extern "C" {
+#include <libavutil/common.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/log.h>
+#include <libavutil/pixdesc.h>
+}
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include "ffms.h"
+#include "ffmscompat.h"
+
+std::string SampleFile;
+FFMS_Index *Index;
+int VideoTrack;
+
+static void Check(bool Condition, const std::string &What) {
+	if (!Condition)
+		throw What;
+}
+
+static FFMS_VideoSource *OpenVideo(FFMS_Index *Index, int Flags, int Threads = 1) {
+	char ErrorMsg[1024];
+	FFMS_ErrorInfo E;
+	E.Buffer = ErrorMsg;
+	E.BufferSize = sizeof(ErrorMsg);
+
+	FFMS_VideoSource *V = FFMS_CreateVideoSource2(SampleFile.c_str(), VideoTrack, Index, Threads, FFMS_SEEK_NORMAL, Flags, &E);
+	if (!V)
+		throw std::string("Failed to open video: ") + E.Buffer;
+	return V;
+}
+
+static const FFMS_Frame *GetFrame(FFMS_VideoSource *V, int n) {
+	char ErrorMsg[1024];
+	FFMS_ErrorInfo E;
+	E.Buffer = ErrorMsg;
+	E.BufferSize = sizeof(ErrorMsg);
+
+	const FFMS_Frame *Frame = FFMS_GetFrame(V, n, &E);
+	if (!Frame)
+		throw std::string("Failed to get frame: ") + E.Buffer;
+	return Frame;
+}
+
+// A fingerprint of the first plane, which is enough to tell frames apart
+static unsigned HashFrame(const FFMS_Frame *Frame) {
+	unsigned Hash = 2166136261u;
+	for (int y = 0; y < Frame->EncodedHeight; y++) {
+		const uint8_t *Row = Frame->Data[0] + y * Frame->Linesize[0];
+		for (int x = 0; x < Frame->EncodedWidth; x++)
+			Hash = (Hash ^ Row[x]) * 16777619u;
+	}
+	return Hash;
+}
+
+struct Delivery {
+	int n;
+	int Position;
+	unsigned Hash;
+};
+
+static int FFMS_CC RecordFrame(int n, int Position, const FFMS_Frame *Frame, void *Private) {
+	Delivery D = { n, Position, HashFrame(Frame) };
+	static_cast<std::vector<Delivery> *>(Private)->push_back(D);
+	return 0;
+}
+
+// Every requested position is delivered exactly once with the frame that
+// FFMS_GetFrame returns for it, in ascending frame order
+static void TestGetFramesOrdering() {
+	char ErrorMsg[1024];
+	FFMS_ErrorInfo E;
+	E.Buffer = ErrorMsg;
+	E.BufferSize = sizeof(ErrorMsg);
+
+	FFMS_VideoSource *V = OpenVideo(Index, 0);
+	int NumFrames = FFMS_GetVideoProperties(V)->NumFrames;
+	int Last = NumFrames - 1;
+	int Frames[] = { Last, 0, Last / 2, 0, FFMAX(Last - 1, 0), FFMIN(Last / 2 + 1, Last), FFMIN(1, Last) };
+	int Count = sizeof(Frames) / sizeof(Frames[0]);
+
+	std::vector<Delivery> Delivered;
+	int Result = FFMS_GetFrames(V, Frames, Count, RecordFrame, &Delivered, &E);
+	FFMS_DestroyVideoSource(V);
+	Check(Result == FFMS_ERROR_SUCCESS, std::string("FFMS_GetFrames failed: ") + E.Buffer);
+	Check(static_cast<int>(Delivered.size()) == Count, "FFMS_GetFrames didn't deliver every requested frame");
+
+	std::vector<int> Seen(Count, 0);
+	for (size_t i = 0; i < Delivered.size(); i++) {
+		Check(Delivered[i].Position >= 0 && Delivered[i].Position < Count, "FFMS_GetFrames delivered an invalid position");
+		Check(!Seen[Delivered[i].Position]++, "FFMS_GetFrames delivered a position twice");
+		Check(Delivered[i].n == Frames[Delivered[i].Position], "FFMS_GetFrames delivered the wrong frame for a position");
+		Check(i == 0 || Delivered[i - 1].n <= Delivered[i].n, "FFMS_GetFrames didn't deliver the frames in ascending order");
+	}
+
+	V = OpenVideo(Index, 0);
+	try {
+		for (size_t i = 0; i < Delivered.size(); i++)
+			Check(HashFrame(GetFrame(V, Delivered[i].n)) == Delivered[i].Hash, "FFMS_GetFrames delivered a different picture than FFMS_GetFrame");
+	} catch (...) {
+		FFMS_DestroyVideoSource(V);
+		throw;
+	}
+	FFMS_DestroyVideoSource(V);
+}
+
+// Crops that don't fit the frame are rejected and leave the previous crop in
+// place, and a valid crop only offsets the planes
+static void TestSetCropBounds() {
+	char ErrorMsg[1024];
+	FFMS_ErrorInfo E;
+	E.Buffer = ErrorMsg;
+	E.BufferSize = sizeof(ErrorMsg);
+
+	FFMS_VideoSource *V = OpenVideo(Index, 0);
+	try {
+		const FFMS_Frame *Frame = GetFrame(V, 0);
+		int Width = Frame->EncodedWidth;
+		int Height = Frame->EncodedHeight;
+		int Format = Frame->EncodedPixelFormat;
+		Check(Width > 64 && Height > 64, "The sample is too small to crop");
+		std::vector<uint8_t> Row(Frame->Data[0] + 16 * Frame->Linesize[0] + 16, Frame->Data[0] + 16 * Frame->Linesize[0] + Width - 16);
+
+		Check(FFMS_SetCropV(V, -2, 0, 0, 0, &E) != FFMS_ERROR_SUCCESS, "A negative crop was accepted");
+		Check(FFMS_SetCropV(V, 0, 0, 0, -2, &E) != FFMS_ERROR_SUCCESS, "A negative crop was accepted");
+		Check(FFMS_SetCropV(V, Width / 2, 0, Width - Width / 2, 0, &E) != FFMS_ERROR_SUCCESS, "Cropping the whole width was accepted");
+		Check(FFMS_SetCropV(V, 0, Height, 0, 0, &E) != FFMS_ERROR_SUCCESS, "Cropping the whole height was accepted");
+		if (Format == FFMS_GetPixFmt("yuv420p") || Format == FFMS_GetPixFmt("yuv422p"))
+			Check(FFMS_SetCropV(V, 1, 0, 0, 0, &E) != FFMS_ERROR_SUCCESS, "A crop splitting chroma samples was accepted");
+
+		Check(FFMS_SetCropV(V, 16, 16, 16, 16, &E) == FFMS_ERROR_SUCCESS, std::string("A valid crop was rejected: ") + E.Buffer);
+		Check(FFMS_SetCropV(V, Width, 0, 0, 0, &E) != FFMS_ERROR_SUCCESS, "Cropping the whole width was accepted");
+
+		Frame = GetFrame(V, 0);
+		Check(Frame->EncodedWidth == Width - 32 && Frame->EncodedHeight == Height - 32, "A rejected crop replaced the valid one");
+		Check(std::equal(Row.begin(), Row.end(), Frame->Data[0]), "The cropped frame doesn't start at the crop offset");
+
+		Check(FFMS_SetCropV(V, 0, 0, 0, 0, &E) == FFMS_ERROR_SUCCESS, std::string("Removing the crop failed: ") + E.Buffer);
+		Frame = GetFrame(V, 0);
+		Check(Frame->EncodedWidth == Width && Frame->EncodedHeight == Height, "Removing the crop didn't restore the frame size");
+	} catch (...) {
+		FFMS_DestroyVideoSource(V);
+		throw;
+	}
+	FFMS_DestroyVideoSource(V);
+}
+
+// Without a scaler the fields are views into the frame, so row r of the top
+// field is row 2r of the frame and row r of the bottom field is row 2r+1
+static void TestGetFrameFieldParity() {
+	char ErrorMsg[1024];
+	FFMS_ErrorInfo E;
+	E.Buffer = ErrorMsg;
+	E.BufferSize = sizeof(ErrorMsg);
+
+	FFMS_VideoSource *V = OpenVideo(Index, 0);
+	try {
+		int n = FFMS_GetVideoProperties(V)->NumFrames / 2;
+		const FFMS_Frame *Frame = GetFrame(V, n);
+		Check(Frame->Field == FFMS_FIELD_NONE, "A whole frame was marked as a field");
+		int Width = Frame->EncodedWidth;
+		int Height = Frame->EncodedHeight;
+		PixelFormat Format = static_cast<PixelFormat>(Frame->EncodedPixelFormat);
+		const AVPixFmtDescriptor &Desc = av_pix_fmt_descriptors[Format];
+		Check(!(Desc.flags & PIX_FMT_PAL), "The sample is paletted");
+
+		if (Height % (2 << Desc.log2_chroma_h)) {
+			Check(!FFMS_GetFrameField(V, n, FFMS_FIELD_TOP, &E), "A frame that can't be split into fields was split");
+			FFMS_DestroyVideoSource(V);
+			return;
+		}
+
+		std::vector<std::vector<uint8_t> > Rows[4];
+		for (int i = 0; i < 4 && Frame->Data[i]; i++) {
+			int PlaneWidth = av_image_get_linesize(Format, Width, i);
+			int PlaneHeight = (i == 1 || i == 2) ? -((-Height) >> Desc.log2_chroma_h) : Height;
+			for (int y = 0; y < PlaneHeight; y++) {
+				const uint8_t *Row = Frame->Data[i] + y * Frame->Linesize[i];
+				Rows[i].push_back(std::vector<uint8_t>(Row, Row + PlaneWidth));
+			}
+		}
+
+		for (int Field = FFMS_FIELD_TOP; Field <= FFMS_FIELD_BOTTOM; Field++) {
+			Frame = FFMS_GetFrameField(V, n, Field, &E);
+			Check(Frame != NULL, std::string("Failed to get field: ") + E.Buffer);
+			Check(Frame->Field == Field, "The field has the wrong parity set");
+			Check(Frame->EncodedWidth == Width && Frame->EncodedHeight == Height / 2, "The field has the wrong size");
+			for (int i = 0; i < 4 && Frame->Data[i]; i++) {
+				for (size_t y = Field; y < Rows[i].size(); y += 2)
+					Check(std::equal(Rows[i][y].begin(), Rows[i][y].end(), Frame->Data[i] + (y / 2) * Frame->Linesize[i]),
+						"A field row doesn't match the frame row it comes from");
+			}
+		}
+
+		Check(GetFrame(V, n)->Field == FFMS_FIELD_NONE, "The field request stuck to the next frame");
+	} catch (...) {
+		FFMS_DestroyVideoSource(V);
+		throw;
+	}
+	FFMS_DestroyVideoSource(V);
+}
+
+// A written and read back index describes the same frames and, for lavf
+// sources, carries the codec parameters a lazily opened source relies on
+static void TestIndexRoundTrip() {
+	char ErrorMsg[1024];
+	FFMS_ErrorInfo E;
+	E.Buffer = ErrorMsg;
+	E.BufferSize = sizeof(ErrorMsg);
+
+	std::string IndexFile = SampleFile + ".regression.ffindex";
+	Check(FFMS_WriteIndex(IndexFile.c_str(), Index, &E) == FFMS_ERROR_SUCCESS, std::string("Failed to write the index: ") + E.Buffer);
+	FFMS_Index *ReadIndex = FFMS_ReadIndex(IndexFile.c_str(), &E);
+	remove(IndexFile.c_str());
+	Check(ReadIndex != NULL, std::string("Failed to read the index: ") + E.Buffer);
+
+	FFMS_VideoSource *V = NULL;
+	FFMS_VideoSource *Lazy = NULL;
+	try {
+		Check(FFMS_IndexBelongsToFile(ReadIndex, SampleFile.c_str(), &E) == FFMS_ERROR_SUCCESS, "The read index doesn't belong to the sample");
+		Check(FFMS_GetSourceType(ReadIndex) == FFMS_GetSourceType(Index), "The read index has a different source type");
+
+		FFMS_Track *Track = FFMS_GetTrackFromIndex(Index, VideoTrack);
+		FFMS_Track *ReadTrack = FFMS_GetTrackFromIndex(ReadIndex, VideoTrack);
+		Check(FFMS_GetNumFrames(ReadTrack) == FFMS_GetNumFrames(Track), "The read index has a different number of frames");
+		for (int i = 0; i < FFMS_GetNumFrames(Track); i++) {
+			const FFMS_FrameInfo *Info = FFMS_GetFrameInfo(Track, i);
+			const FFMS_FrameInfo *ReadInfo = FFMS_GetFrameInfo(ReadTrack, i);
+			Check(ReadInfo->PTS == Info->PTS && ReadInfo->KeyFrame == Info->KeyFrame, "The read index has different frame info");
+		}
+
+		if (FFMS_GetSourceType(ReadIndex) == FFMS_SOURCE_LAVF) {
+			Lazy = OpenVideo(ReadIndex, FFMS_VSF_LAZY);
+			const FFMS_VideoProperties LazyVP = *FFMS_GetVideoProperties(Lazy);
+			V = OpenVideo(Index, 0);
+			const FFMS_VideoProperties *VP = FFMS_GetVideoProperties(V);
+			Check(LazyVP.NumFrames == VP->NumFrames, "The lazy source has a different number of frames");
+			Check(LazyVP.EncodedWidth == VP->EncodedWidth && LazyVP.EncodedHeight == VP->EncodedHeight,
+				"The lazy source has a different frame size");
+			Check(LazyVP.EncodedPixelFormat == VP->EncodedPixelFormat, "The lazy source has a different pixel format");
+			Check(LazyVP.SARNum == VP->SARNum && LazyVP.SARDen == VP->SARDen, "The lazy source has a different sample aspect ratio");
+			Check(HashFrame(GetFrame(Lazy, 0)) == HashFrame(GetFrame(V, 0)), "The lazy source decoded a different first frame");
+		}
+	} catch (...) {
+		FFMS_DestroyVideoSource(V);
+		FFMS_DestroyVideoSource(Lazy);
+		FFMS_DestroyIndex(ReadIndex);
+		throw;
+	}
+	FFMS_DestroyVideoSource(V);
+	FFMS_DestroyVideoSource(Lazy);
+	FFMS_DestroyIndex(ReadIndex);
+}
+
+// Stepping backwards one frame at a time, which is served from the buffer of
+// the decoded GOP, gives the same frames as decoding forwards
+static void TestReverseStepping() {
+	FFMS_VideoSource *V = OpenVideo(Index, 0);
+	int NumFrames = FFMS_GetVideoProperties(V)->NumFrames;
+	int End = FFMIN(NumFrames / 2 + 8, NumFrames - 1);
+	int Start = FFMAX(End - 16, 0);
+
+	std::vector<unsigned> Forward;
+	try {
+		for (int n = Start; n <= End; n++)
+			Forward.push_back(HashFrame(GetFrame(V, n)));
+	} catch (...) {
+		FFMS_DestroyVideoSource(V);
+		throw;
+	}
+	FFMS_DestroyVideoSource(V);
+
+	V = OpenVideo(Index, 0);
+	try {
+		for (int n = End; n >= Start; n--)
+			Check(HashFrame(GetFrame(V, n)) == Forward[n - Start], "Stepping backwards gave a different frame than decoding forwards");
+	} catch (...) {
+		FFMS_DestroyVideoSource(V);
+		throw;
+	}
+	FFMS_DestroyVideoSource(V);
+}
+
+// Postprocessing in bands on several threads gives the same pictures as
+// postprocessing the whole frame on one
+static void TestBandedPostprocessing() {
+	char ErrorMsg[1024];
+	FFMS_ErrorInfo E;
+	E.Buffer = ErrorMsg;
+	E.BufferSize = sizeof(ErrorMsg);
+
+	// The sample has no quantizers so the strength is forced
+	const char *PP = "hb,vb,dr,fq:15";
+
+	FFMS_VideoSource *Serial = OpenVideo(Index, 0);
+	FFMS_VideoSource *Banded = NULL;
+	try {
+		if (FFMS_SetPP(Serial, PP, &E) != FFMS_ERROR_SUCCESS) {
+			Check(E.SubType == FFMS_ERROR_UNSUPPORTED, std::string("Failed to set postprocessing: ") + E.Buffer);
+			// Built without postprocessing
+			FFMS_DestroyVideoSource(Serial);
+			return;
+		}
+		Banded = OpenVideo(Index, 0, 4);
+		Check(FFMS_SetPP(Banded, PP, &E) == FFMS_ERROR_SUCCESS, std::string("Failed to set postprocessing: ") + E.Buffer);
+
+		int NumFrames = FFMS_GetVideoProperties(Serial)->NumFrames;
+		for (int n = 0; n < FFMIN(NumFrames, 8); n++) {
+			const FFMS_Frame *A = GetFrame(Serial, n);
+			const FFMS_Frame *B = GetFrame(Banded, n);
+			Check(A->EncodedWidth == B->EncodedWidth && A->EncodedHeight == B->EncodedHeight &&
+				A->ConvertedPixelFormat == B->ConvertedPixelFormat, "The postprocessed frames have different formats");
+			PixelFormat Format = static_cast<PixelFormat>(A->ConvertedPixelFormat);
+			const AVPixFmtDescriptor &Desc = av_pix_fmt_descriptors[Format];
+			for (int i = 0; i < 4 && A->Data[i]; i++) {
+				int PlaneWidth = av_image_get_linesize(Format, A->EncodedWidth, i);
+				int PlaneHeight = (i == 1 || i == 2) ? -((-A->EncodedHeight) >> Desc.log2_chroma_h) : A->EncodedHeight;
+				for (int y = 0; y < PlaneHeight; y++) {
+					const uint8_t *Row = A->Data[i] + y * A->Linesize[i];
+					Check(std::equal(Row, Row + PlaneWidth, B->Data[i] + y * B->Linesize[i]),
+						"Postprocessing in bands changed the picture");
+				}
+			}
+		}
+	} catch (...) {
+		FFMS_DestroyVideoSource(Serial);
+		if (Banded)
+			FFMS_DestroyVideoSource(Banded);
+		throw;
+	}
+	FFMS_DestroyVideoSource(Serial);
+	FFMS_DestroyVideoSource(Banded);
+}
+
+static void PutTag(std::vector<uint8_t> &Buf, const char *Tag) {
+	Buf.insert(Buf.end(), Tag, Tag + 4);
+}
+
+static void Put16(std::vector<uint8_t> &Buf, unsigned Value) {
+	Buf.push_back(Value & 0xFF);
+	Buf.push_back((Value >> 8) & 0xFF);
+}
+
+static void Put32(std::vector<uint8_t> &Buf, unsigned Value) {
+	Put16(Buf, Value & 0xFFFF);
+	Put16(Buf, Value >> 16);
+}
+
+static void Patch32(std::vector<uint8_t> &Buf, size_t Pos, unsigned Value) {
+	for (int i = 0; i < 4; i++)
+		Buf[Pos + i] = (Value >> (8 * i)) & 0xFF;
+}
+
+// Writes an indexed AVI of planar yuv420p frames, which needs no encoder and
+// which every libavformat can read and seek in
+static void WriteSample(const std::string &File) {
+	// Tall enough to be postprocessed in two bands
+	const int Width = 352;
+	const int Height = 288;
+	const int NumFrames = 50;
+	const unsigned FrameSize = Width * Height * 3 / 2;
+
+	std::vector<uint8_t> Buf;
+	PutTag(Buf, "RIFF");
+	Put32(Buf, 0);
+	PutTag(Buf, "AVI ");
+
+	PutTag(Buf, "LIST");
+	Put32(Buf, 4 + 8 + 56 + 8 + 4 + 8 + 56 + 8 + 40);
+	PutTag(Buf, "hdrl");
+	PutTag(Buf, "avih");
+	Put32(Buf, 56);
+	Put32(Buf, 40000); // 25 fps
+	Put32(Buf, FrameSize * 25);
+	Put32(Buf, 0);
+	Put32(Buf, 0x10); // AVIF_HASINDEX
+	Put32(Buf, NumFrames);
+	Put32(Buf, 0);
+	Put32(Buf, 1);
+	Put32(Buf, FrameSize);
+	Put32(Buf, Width);
+	Put32(Buf, Height);
+	for (int i = 0; i < 4; i++)
+		Put32(Buf, 0);
+
+	PutTag(Buf, "LIST");
+	Put32(Buf, 4 + 8 + 56 + 8 + 40);
+	PutTag(Buf, "strl");
+	PutTag(Buf, "strh");
+	Put32(Buf, 56);
+	PutTag(Buf, "vids");
+	PutTag(Buf, "I420");
+	Put32(Buf, 0);
+	Put32(Buf, 0);
+	Put32(Buf, 0);
+	Put32(Buf, 1);
+	Put32(Buf, 25);
+	Put32(Buf, 0);
+	Put32(Buf, NumFrames);
+	Put32(Buf, FrameSize);
+	Put32(Buf, 0xFFFFFFFF);
+	Put32(Buf, 0);
+	Put16(Buf, 0);
+	Put16(Buf, 0);
+	Put16(Buf, Width);
+	Put16(Buf, Height);
+	PutTag(Buf, "strf");
+	Put32(Buf, 40);
+	Put32(Buf, 40);
+	Put32(Buf, Width);
+	Put32(Buf, Height);
+	Put16(Buf, 1);
+	Put16(Buf, 12);
+	PutTag(Buf, "I420");
+	Put32(Buf, FrameSize);
+	for (int i = 0; i < 4; i++)
+		Put32(Buf, 0);
+
+	PutTag(Buf, "LIST");
+	size_t MoviSize = Buf.size();
+	Put32(Buf, 0);
+	size_t Movi = Buf.size();
+	PutTag(Buf, "movi");
+	std::vector<unsigned> Offsets;
+	for (int n = 0; n < NumFrames; n++) {
+		Offsets.push_back(Buf.size() - Movi);
+		PutTag(Buf, "00dc");
+		Put32(Buf, FrameSize);
+		// Something that moves and differs between the planes, with detail
+		// for the postprocessing filters to act on
+		for (int y = 0; y < Height; y++)
+			for (int x = 0; x < Width; x++)
+				Buf.push_back((x * 3 + y * 5 + n * 7 + ((x ^ y) & 8) * 4) & 0xFF);
+		for (int Plane = 0; Plane < 2; Plane++)
+			for (int y = 0; y < Height / 2; y++)
+				for (int x = 0; x < Width / 2; x++)
+					Buf.push_back((128 + (Plane ? x : y) + n * (Plane ? 3 : -3)) & 0xFF);
+	}
+	Patch32(Buf, MoviSize, Buf.size() - Movi);
+
+	PutTag(Buf, "idx1");
+	Put32(Buf, NumFrames * 16);
+	for (int n = 0; n < NumFrames; n++) {
+		PutTag(Buf, "00dc");
+		Put32(Buf, 0x10); // AVIIF_KEYFRAME
+		Put32(Buf, Offsets[n]);
+		Put32(Buf, FrameSize);
+	}
+	Patch32(Buf, 4, Buf.size() - 8);
+
+	FILE *F = fopen(File.c_str(), "wb");
+	if (!F || fwrite(&Buf[0], 1, Buf.size(), F) != Buf.size() || fclose(F))
+		throw std::string("Failed to write ") + File;
+}
+
+static bool RunTest(void (*Test)(), const char *Name) {
+	try {
+		Test();
+	} catch (const std::string &Error) {
+		std::cout << "FAIL: " << Name << ": " << Error << std::endl;
+		return false;
+	}
+	std::cout << "PASS: " << Name << std::endl;
+	return true;
+}
+
+int main(int argc, char *argv[]) {
+	if (argc > 1)
+		SampleFile = argv[1];
+	else if (getenv("FFMS2_TEST_SAMPLE"))
+		SampleFile = getenv("FFMS2_TEST_SAMPLE");
+
+	bool OwnSample = SampleFile.empty();
+	if (OwnSample) {
+		SampleFile = "regression-sample.avi";
+		try {
+			WriteSample(SampleFile);
+		} catch (const std::string &Error) {
+			std::cout << Error << std::endl;
+			return 1;
+		}
+	}
+
+	FFMS_Init(0, 1);
+	FFMS_SetLogLevel(AV_LOG_QUIET);
+
+	char ErrorMsg[1024];
+	FFMS_ErrorInfo E;
+	E.Buffer = ErrorMsg;
+	E.BufferSize = sizeof(ErrorMsg);
+
+	Index = FFMS_MakeIndex(SampleFile.c_str(), 0, 0, NULL, NULL, FFMS_IEH_ABORT, NULL, NULL, &E);
+	if (!Index) {
+		std::cout << "Indexing error: " << E.Buffer << std::endl;
+		if (OwnSample)
+			remove(SampleFile.c_str());
+		return 1;
+	}
+
+	VideoTrack = FFMS_GetFirstTrackOfType(Index, FFMS_TYPE_VIDEO, &E);
+	if (VideoTrack < 0) {
+		std::cout << "No video track: " << E.Buffer << std::endl;
+		FFMS_DestroyIndex(Index);
+		if (OwnSample)
+			remove(SampleFile.c_str());
+		return 1;
+	}
+
+	bool Passed = true;
+	Passed &= RunTest(TestGetFramesOrdering, "FFMS_GetFrames ordering");
+	Passed &= RunTest(TestReverseStepping, "Reverse stepping");
+	Passed &= RunTest(TestSetCropBounds, "FFMS_SetCropV bounds");
+	Passed &= RunTest(TestGetFrameFieldParity, "FFMS_GetFrameField parity");
+	Passed &= RunTest(TestIndexRoundTrip, "Index round-trip");
+	Passed &= RunTest(TestBandedPostprocessing, "Banded postprocessing");
+
+	FFMS_DestroyIndex(Index);
+	if (OwnSample)
+		remove(SampleFile.c_str());
+	return Passed ? 0 : 1;
+}